@@ -6,16 +6,20 @@
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
 
 /**
  * Initialise a queue data structure.
  *
  * q (Queue*): the queue to initialise
+ * capacity (int): the most positions the queue will hold at once
  *
  */
-void init_queue(Queue* q) {
+void init_queue(Queue* q, int capacity) {
+    q->capacity = capacity > 0 ? capacity : 1;
+    q->positions = malloc(sizeof(Position) * q->capacity);
     q->head = 0;
-    q->tail = 0;
+    q->size = 0;
 }
 
 /**
@@ -25,32 +29,23 @@ void init_queue(Queue* q) {
  *
  */
 void free_queue(Queue* q) {
-    struct Node* head = q->head;
-    while (head != 0) {
-        struct Node* temp = head;
-        head = head->next;
-        free(temp);
-    }
+    free(q->positions);
+    q->positions = NULL;
 }
 
 /**
- * Add an element to the end of queue.
+ * Add an element to the end of queue. A full queue is left unchanged.
  *
  * q (Queue*): the queue to update
  * pos (Position): the position to add
  *
  */
 void add_queue(Queue* q, Position pos) {
-    if (q->head == 0) {
-        q->tail = q->head = malloc(sizeof(struct Node));
-        q->head->next = 0;
-    } else {
-        struct Node* n = malloc(sizeof(struct Node));
-        n->next = 0;
-        q->tail->next = n;
-        q->tail = n;
+    if (q->size == q->capacity) {
+        return;
     }
-    q->tail->pos = pos;
+    int tail = q->head + q->size++;
+    q->positions[tail < q->capacity ? tail : tail - q->capacity] = pos;
 }
 
 /**
@@ -62,51 +57,482 @@ void add_queue(Queue* q, Position pos) {
  *
  */
 Position get_queue(Queue* q) {
-    if (q->head == 0) {
+    if (q->size == 0) {
         Position pos = {0, 0};
         return pos;
     }
-    Position result = q->head->pos;
-    struct Node* temp = q->head;
-    q->head = q->head->next;
-    free(temp);
-
-    if (q->head == 0) {
-        q->tail = 0;
+    Position result = q->positions[q->head];
+    if (++q->head == q->capacity) {
+        q->head = 0;
     }
+    q->size--;
     return result;
 }
 
 /**
  * Check if a queue is empty.
  *
- * q (Queue*): the queue to check
+ * q (Queue): the queue to check
  *
  * Returns true if the queue is empty.
  *
  */
 bool is_empty(Queue q) {
-    return q.head == 0;
+    return q.size == 0;
+}
+
+/**
+ * Initialise an empty set of the cells of a board.
+ *
+ * set (CellSet*): the set to initialise
+ * numCells (int): the number of cells of the board
+ * sparse (bool): keep only the cells added, for boards too large to give
+ *   every cell a bit
+ *
+ */
+void init_cell_set(CellSet* set, int numCells, bool sparse) {
+    set->bits = NULL;
+    set->cells = empty_cell_table();
+    set->sparse = sparse;
+    if (!sparse) {
+        set->bits = calloc((numCells + 63) / 64, sizeof(uint64_t));
+    }
+}
+
+/**
+ * Free the memory of a set.
+ *
+ * set (CellSet*): the set to be freed
+ *
+ */
+void free_cell_set(CellSet* set) {
+    free(set->bits);
+    free_cell_table(&set->cells);
+}
+
+/**
+ * Add a cell to a set.
+ *
+ * set (CellSet*): the set to update
+ * cell (int): the cell to add
+ *
+ * Returns true if the cell was added, false if it was already in the set.
+ *
+ */
+bool add_to_set(CellSet* set, int cell) {
+    if (set->sparse) {
+        if (get_cell_value(&set->cells, cell)) {
+            return false;
+        }
+        set_cell_value(&set->cells, cell, 1);
+        return true;
+    }
+    uint64_t bit = 1ULL << (cell % 64);
+    if (set->bits[cell / 64] & bit) {
+        return false;
+    }
+    set->bits[cell / 64] |= bit;
+    return true;
+}
+
+/**
+ * Initialise a pool holding every cell of a board.
+ *
+ * pool (CellPool*): the pool to initialise
+ * numCells (int): the number of cells of the board
+ * sparse (bool): keep only the moved entries, for boards too large to give
+ *   every cell an entry
+ *
+ */
+void init_pool(CellPool* pool, int numCells, bool sparse) {
+    pool->cells = NULL;
+    pool->places = NULL;
+    pool->movedCells = empty_cell_table();
+    pool->movedPlaces = empty_cell_table();
+    pool->sparse = sparse;
+    pool->size = numCells;
+    if (!sparse) {
+        pool->cells = malloc(sizeof(int) * numCells);
+        pool->places = malloc(sizeof(int) * numCells);
+        for (int cell = 0; cell < numCells; cell++) {
+            pool->cells[cell] = pool->places[cell] = cell;
+        }
+    }
+}
+
+/**
+ * Free the memory of a pool.
+ *
+ * pool (CellPool*): the pool to be freed
+ *
+ */
+void free_pool(CellPool* pool) {
+    free(pool->cells);
+    free(pool->places);
+    free_cell_table(&pool->movedCells);
+    free_cell_table(&pool->movedPlaces);
+}
+
+/**
+ * Gets the cell at an entry of a pool.
+ *
+ * pool (CellPool*): the pool
+ * entry (int): the entry
+ *
+ * Returns the cell.
+ *
+ */
+int pool_cell(CellPool* pool, int entry) {
+    if (!pool->sparse) {
+        return pool->cells[entry];
+    }
+    int moved = get_cell_value(&pool->movedCells, entry);
+    return moved ? moved - 1 : entry;
+}
+
+/**
+ * Gets the entry of a pool holding a cell.
+ *
+ * pool (CellPool*): the pool
+ * cell (int): the cell
+ *
+ * Returns the entry.
+ *
+ */
+int pool_place(CellPool* pool, int cell) {
+    if (!pool->sparse) {
+        return pool->places[cell];
+    }
+    int moved = get_cell_value(&pool->movedPlaces, cell);
+    return moved ? moved - 1 : cell;
+}
+
+/**
+ * Put a cell at an entry of a pool.
+ *
+ * pool (CellPool*): the pool to update
+ * entry (int): the entry
+ * cell (int): the cell
+ *
+ */
+void set_pool_cell(CellPool* pool, int entry, int cell) {
+    if (pool->sparse) {
+        set_cell_value(&pool->movedCells, entry, cell + 1);
+        set_cell_value(&pool->movedPlaces, cell, entry + 1);
+    } else {
+        pool->cells[entry] = cell;
+        pool->places[cell] = entry;
+    }
+}
+
+/**
+ * Take a cell out of a pool by swapping it with the last unguessed cell.
+ * Cells already taken out are left alone.
+ *
+ * pool (CellPool*): the pool to update
+ * cell (int): the cell that has been guessed
+ *
+ */
+void remove_from_pool(CellPool* pool, int cell) {
+    int entry = pool_place(pool, cell);
+    if (entry >= pool->size) {
+        return;
+    }
+    int last = pool_cell(pool, --pool->size);
+    set_pool_cell(pool, entry, last);
+    set_pool_cell(pool, pool->size, cell);
 }
 
 /**
- * Check if a position is in a queue.
+ * Pick one of the cells in a pool, each with the same chance.
  *
- * q (Queue): the queue to look in
- * pos (Position): the position to find
+ * pool (CellPool*): the pool
+ * seed (unsigned int*): the random number generator of the game
  *
- * Returns true if the postition was found.
+ * Returns the cell, or -1 if the pool is empty.
  *
  */
-bool queue_in(Queue* q, Position pos) {
-    struct Node* current = q->head;
-    while (current != 0) {
-        if (positions_equal(current->pos, pos)) {
-            return true;
+int random_from_pool(CellPool* pool, unsigned int* seed) {
+    if (pool->size == 0) {
+        return -1;
+    }
+    return pool_cell(pool, rand_r(seed) % pool->size);
+}
+
+/**
+ * Find the first column of a row on a lattice.
+ *
+ * lattice (Lattice*): the lattice
+ * row (int): the row
+ *
+ * Returns the column, which may be past the last column of the board.
+ *
+ */
+int first_lattice_col(Lattice* lattice, int row) {
+    return (lattice->spacing - row % lattice->spacing) % lattice->spacing;
+}
+
+/**
+ * Gets the index of a cell on a lattice: its row times the most lattice
+ * cells a row can hold, plus its place along the row.
+ *
+ * lattice (Lattice*): the lattice
+ * pos (Position): a position on the lattice
+ *
+ * Returns the index.
+ *
+ */
+int lattice_index(Lattice* lattice, Position pos) {
+    return pos.row * lattice->width + 
+            (pos.col - first_lattice_col(lattice, pos.row)) / 
+            lattice->spacing;
+}
+
+/**
+ * Gets the cell of the board at an index of a lattice.
+ *
+ * lattice (Lattice*): the lattice
+ * index (int): the index
+ *
+ * Returns the cell, or -1 if the index is past the last lattice cell of
+ * its row, as the last one is in rows holding fewer than the width.
+ *
+ */
+int lattice_cell(Lattice* lattice, int index) {
+    int row = index / lattice->width;
+    int col = first_lattice_col(lattice, row) + 
+            index % lattice->width * lattice->spacing;
+    return col < lattice->cols ? row * lattice->cols + col : -1;
+}
+
+/**
+ * Fill the pool of a lattice with every cell on it, for its spacing. A row
+ * holds one lattice cell fewer than the width when its first one is far
+ * enough in, so that index is taken out of the pool.
+ *
+ * lattice (Lattice*): the lattice to fill
+ *
+ */
+void fill_lattice(Lattice* lattice) {
+    lattice->width = (lattice->cols + lattice->spacing - 1) / 
+            lattice->spacing;
+    init_pool(&lattice->cells, lattice->rows * lattice->width, 
+            is_sparse_board(lattice->rows, lattice->cols));
+    for (int row = 0; row < lattice->rows; row++) {
+        int last = row * lattice->width + lattice->width - 1;
+        if (lattice_cell(lattice, last) < 0) {
+            remove_from_pool(&lattice->cells, last);
+        }
+    }
+}
+
+/**
+ * Create the lattice of a game with every ship afloat.
+ *
+ * rules (Rules): the rules of the game, with the ship lengths of its maps
+ *
+ * Returns the lattice, to be freed with free_lattice.
+ *
+ */
+Lattice* new_lattice(Rules rules) {
+    Lattice* lattice = malloc(sizeof(Lattice));
+    // Each distinct length, shortest first
+    lattice->lengths = malloc(sizeof(int) * (rules.numShips + 1));
+    lattice->afloat = malloc(sizeof(int) * (rules.numShips + 1));
+    lattice->numLengths = 0;
+    for (int ship = 0; ship < rules.numShips; ship++) {
+        int length = rules.shipLengths[ship];
+        int i = 0;
+        while (i < lattice->numLengths && lattice->lengths[i] < length) {
+            i++;
         }
-        current = current->next;
+        if (i < lattice->numLengths && lattice->lengths[i] == length) {
+            lattice->afloat[i]++;
+            continue;
+        }
+        memmove(&lattice->lengths[i + 1], &lattice->lengths[i],
+                sizeof(int) * (lattice->numLengths - i));
+        memmove(&lattice->afloat[i + 1], &lattice->afloat[i],
+                sizeof(int) * (lattice->numLengths - i));
+        lattice->lengths[i] = length;
+        lattice->afloat[i] = 1;
+        lattice->numLengths++;
     }
-    return false;
+    lattice->shortest = 0;
+    lattice->spacing = lattice->numLengths ? lattice->lengths[0] : 1;
+    lattice->rows = rules.numRows;
+    lattice->cols = rules.numCols;
+    fill_lattice(lattice);
+    return lattice;
+}
+
+/**
+ * Free the memory of a lattice.
+ *
+ * lattice (Lattice*): the lattice to be freed
+ *
+ */
+void free_lattice(Lattice* lattice) {
+    free(lattice->lengths);
+    free(lattice->afloat);
+    free_pool(&lattice->cells);
+    free(lattice);
+}
+
+/**
+ * Checks if a position is on a lattice.
+ *
+ * lattice (Lattice*): the lattice
+ * pos (Position): the position to check
+ *
+ * Returns true if (row + col) % spacing == 0, otherwise false.
+ *
+ */
+bool on_lattice(Lattice* lattice, Position pos) {
+    return (pos.row + pos.col) % lattice->spacing == 0;
+}
+
+/**
+ * Take a cell we have guessed out of the pool of a lattice, if it is on it.
+ *
+ * lattice (Lattice*): the lattice to update
+ * pos (Position): the position guessed
+ *
+ */
+void remove_from_lattice(Lattice* lattice, Position pos) {
+    if (on_lattice(lattice, pos)) {
+        remove_from_pool(&lattice->cells, lattice_index(lattice, pos));
+    }
+}
+
+/**
+ * Take the cells already guessed in a game out of its lattice: those past
+ * the unguessed ones in the pool of the game.
+ *
+ * state (AgentState*): the state of the game
+ *
+ */
+void remove_guessed_cells(AgentState* state) {
+    int cols = state->info.rules.numCols;
+    int numCells = state->info.rules.numRows * cols;
+    Lattice* lattice = state->lattice;
+    for (int entry = state->unguessed.size; entry < numCells; entry++) {
+        int cell = pool_cell(&state->unguessed, entry);
+        Position pos = {cell / cols, cell % cols};
+        remove_from_lattice(lattice, pos);
+    }
+}
+
+/**
+ * Fill the pool of a lattice again after its spacing has changed.
+ *
+ * state (AgentState*): the state of the game
+ *
+ */
+void recount_lattice(AgentState* state) {
+    free_pool(&state->lattice->cells);
+    fill_lattice(state->lattice);
+    remove_guessed_cells(state);
+}
+
+/**
+ * Count the hits in a line through a position, up to the longest ship.
+ *
+ * map (HitMap): the opponent's hit map
+ * pos (Position): the position the line goes through, which was hit
+ * dir (Direction): one direction along the line
+ * opposite (Direction): the other direction along the line
+ * limit (int): the longest ship length
+ *
+ * Returns the number of cells hit in a row along the line, including pos.
+ *
+ */
+int count_hit_line(HitMap map, Position pos, Direction dir,
+        Direction opposite, int limit) {
+    int count = 1;
+    Direction directions[2] = {dir, opposite};
+    for (int i = 0; i < 2; i++) {
+        Position current = next_position_in_direction(pos, directions[i]);
+        while (count < limit && current.row >= 0 && current.row < map.rows &&
+                current.col >= 0 && current.col < map.cols &&
+                get_position_info(map, current) == HIT_HIT) {
+            count++;
+            current = next_position_in_direction(current, directions[i]);
+        }
+    }
+    return count;
+}
+
+/**
+ * Update the lattice after we sink a ship. The SUNK message does not say
+ * which ship sank, so it is taken to be the longest afloat that fits in a
+ * line of hits through the cell, or the longest afloat if none fits. Hits
+ * of other ships can only make the line longer, so the guess errs towards
+ * keeping a short ship afloat and the spacing no wider than it should be.
+ *
+ * state (AgentState*): the state of the game
+ * pos (Position): the position of the shot that sank the ship
+ *
+ */
+void sink_on_lattice(AgentState* state, Position pos) {
+    Lattice* lattice = state->lattice;
+    if (lattice->shortest >= lattice->numLengths) {
+        return; // every ship is already thought sunk
+    }
+    HitMap map = state->hitMaps[state->info.id % NUM_AGENTS];
+    int limit = lattice->lengths[lattice->numLengths - 1];
+    int run = count_hit_line(map, pos, DIR_WEST, DIR_EAST, limit);
+    int column = count_hit_line(map, pos, DIR_NORTH, DIR_SOUTH, limit);
+    if (column > run) {
+        run = column;
+    }
+    int sunk = -1;
+    for (int i = lattice->numLengths - 1; i >= lattice->shortest; i--) {
+        if (lattice->afloat[i] == 0) {
+            continue;
+        }
+        if (sunk < 0) {
+            sunk = i; // the longest afloat
+        }
+        if (lattice->lengths[i] <= run) {
+            sunk = i;
+            break;
+        }
+    }
+    lattice->afloat[sunk]--;
+    while (lattice->shortest < lattice->numLengths &&
+            lattice->afloat[lattice->shortest] == 0) {
+        lattice->shortest++;
+    }
+    if (lattice->shortest >= lattice->numLengths) {
+        return; // the game is over, there is nothing left to search for
+    }
+    if (lattice->lengths[lattice->shortest] != lattice->spacing) {
+        lattice->spacing = lattice->lengths[lattice->shortest];
+        recount_lattice(state);
+    }
+}
+
+/**
+ * Pick one of the cells on the lattice we have not guessed, each with the
+ * same chance. Once every lattice cell has been guessed any unguessed cell
+ * will do, as a ship sunk may have been mistaken for a longer one.
+ *
+ * state (AgentState*): the state of the game
+ *
+ * Returns the cell, or -1 if every cell has been guessed.
+ *
+ */
+int random_on_lattice(AgentState* state) {
+    if (state->lattice == NULL) {
+        state->lattice = new_lattice(state->info.rules);
+        remove_guessed_cells(state);
+    }
+    int index = random_from_pool(&state->lattice->cells, &state->info.seed);
+    if (index < 0) {
+        return random_from_pool(&state->unguessed, &state->info.seed);
+    }
+    return lattice_cell(state->lattice, index);
 }
 
 /**
@@ -119,20 +545,95 @@ void free_agent_state(AgentState* state) {
     free_rules(&state->info.rules);
     free_hitmap(&state->hitMaps[0]);
     free_hitmap(&state->hitMaps[1]);
+    free(state->boards[0]);
+    free(state->boards[1]);
     free_map(&state->info.map);
     free_queue(&state->toAttack);
-    free_queue(&state->beenQueued);
+    free_cell_set(&state->tracked);
+    free_pool(&state->unguessed);
+    if (state->lattice != NULL) {
+        free_lattice(state->lattice);
+    }
+    if (state->density != NULL) {
+        free_density_map(state->density);
+    }
+}
+
+/**
+ * Initialise an empty game table.
+ *
+ * table (GameTable*): the table to initialise
+ * info (AgentInfo): the id and map used by every game
+ *
+ */
+void init_game_table(GameTable* table, AgentInfo info) {
+    table->info = info;
+    table->games = NULL;
+    table->size = 0;
+    table->playing = 0;
+    table->binary = false;
+}
+
+/**
+ * Find the state of a game.
+ *
+ * table (GameTable*): the table to look in
+ * game (int): the id of the game, or NO_GAME
+ *
+ * Returns the state of the game or NULL if it is not being played.
+ *
+ */
+AgentState* find_game(GameTable* table, int game) {
+    int index = game == NO_GAME ? 0 : game;
+    if (index < 0 || index >= table->size) {
+        return NULL;
+    }
+    return table->games[index];
+}
+
+/**
+ * Remove a game from the table, freeing its state.
+ *
+ * table (GameTable*): the table to remove from
+ * game (int): the id of the game, or NO_GAME
+ *
+ */
+void remove_game(GameTable* table, int game) {
+    AgentState* state = find_game(table, game);
+    if (state != NULL) {
+        free_agent_state(state);
+        free(state);
+        table->games[game == NO_GAME ? 0 : game] = NULL;
+        table->playing--;
+    }
+}
+
+/**
+ * Free the memory of a game table and every game in it.
+ *
+ * table (GameTable*): the table to be freed
+ *
+ */
+void free_game_table(GameTable* table) {
+    for (int game = 0; game < table->size; game++) {
+        remove_game(table, game);
+    }
+    free(table->games);
+    table->games = NULL;
+    table->size = 0;
+    free_map(&table->info.map);
 }
 
 /**
  * Print to standard error the error message and exit with exit status.
  *
  * err (AgentStatus): The exit code to exit with.
+ * table (GameTable*): the games to be freed, or NULL
  *
  * Exits with code `err`.
  *
  */
-void agent_exit(AgentStatus err, AgentState* state) {
+void agent_exit(AgentStatus err, GameTable* table) {
     switch (err) {
         case AGENT_INCORRECT_ARG_COUNT:
             fprintf(stderr, "Usage: agent id map seed\n");
@@ -152,54 +653,119 @@ void agent_exit(AgentStatus err, AgentState* state) {
         default:
             break;
     }
-    if (state != NULL) {
-        free_agent_state(state);
+    if (table != NULL) {
+        free_game_table(table);
     }
     exit(err);
 }
 
 /**
- * Wait for the DONE message from the HUB.
+ * Send the MAP message to the hub.
  *
- * Returns AGENT_NORMAL if got a DONE, AGENT_COMM_ERR otherwise.
+ * map (Map): the map to communicate
+ * game (int): the id of the game, or NO_GAME
  *
  */
-AgentStatus wait_for_done() {
-    char* next;
-    int id;
-    if ((next = read_line(stdin)) == NULL) {
-        return AGENT_COMM_ERR;
-    }
-    if (check_tag("DONE", next)) {
-        if (sscanf(next, "DONE %d", &id) != 1) {
-            return AGENT_COMM_ERR;
+void send_map_message(Map map, int game) {
+    char text[MAX_POSITION_LENGTH];
+    print_tag(stdout, "MAP", game);
+    printf(" ");
+    for (int ship = 0; ship < map.numShips; ship++) {
+        if (ship > 0) {
+            printf(":");
         }
-        if (id == 1 || id == 2) {
-            fprintf(stderr, "GAME OVER - player %d wins\n", id);
-            free(next);
-            return AGENT_NORMAL;
+        printf("%s,%c", format_position(map.ships[ship].pos, text), 
+                map.ships[ship].dir);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+/**
+ * Take a cell we have guessed out of the pool of unguessed cells, and out
+ * of the lattice once agent B has one.
+ *
+ * state (AgentState*): the state of the game guessed in
+ * pos (Position): the position guessed
+ *
+ */
+void mark_guessed(AgentState* state, Position pos) {
+    if (position_in_bounds(state->info.rules, pos)) {
+        remove_from_pool(&state->unguessed, 
+                pos.row * state->info.rules.numCols + pos.col);
+        if (state->lattice != NULL) {
+            remove_from_lattice(state->lattice, pos);
         }
     }
-    free(next);
-    return AGENT_COMM_ERR;
 }
 
 /**
- * Send the MAP message to the hub.
+ * Update a cell of one of the hit maps, and its text if the map has been
+ * printed.
  *
- * map (Map): the map to communicate
+ * state (AgentState*): the state of the game
+ * map (int): the index of the hit map
+ * pos (Position): the position of the cell
+ * data (char): what the cell now holds
  *
  */
-void send_map_message(Map map) {
-    printf("MAP ");
-    for (int ship = 0; ship < map.numShips; ship++) {
-        if (ship > 0) {
-            printf(":");
+void update_agent_map(AgentState* state, int map, Position pos, char data) {
+    update_hitmap(&state->hitMaps[map], pos, data);
+    if (state->boards[map] != NULL) {
+        state->boards[map][rendered_cell_offset(state->hitMaps[map], pos)] =
+                get_position_info(state->hitMaps[map], pos);
+    }
+}
+
+/**
+ * Take one shot of a salvo. Until the results of the salvo arrive its shots
+ * are marked as pending, so that the strategy does not pick them again.
+ *
+ * state (AgentState*): the state of the game guessed in
+ *
+ * Returns the position to guess.
+ *
+ */
+Position take_shot(AgentState* state) {
+    Position pos = make_guess(state);
+    if (state->info.rules.salvo > 1) {
+        update_agent_map(state, state->info.id % NUM_AGENTS, pos, 
+                HIT_PENDING);
+        mark_guessed(state, pos);
+    }
+    return pos;
+}
+
+/**
+ * Take our turn and send the GUESS message to the hub. We take a shot for
+ * each of the salvo, or for every cell not yet guessed if there are fewer.
+ *
+ * state (AgentState*): the state of the game guessed in
+ * binary (bool): send records of the binary protocol instead of a line
+ *
+ */
+void send_guess_message(AgentState* state, bool binary) {
+    int numShots = count_unguessed(state->hitMaps[state->info.id % 
+            NUM_AGENTS]);
+    if (numShots > state->info.rules.salvo) {
+        numShots = state->info.rules.salvo;
+    }
+    if (!binary) {
+        print_tag(stdout, "GUESS", state->game);
+    }
+    for (int shot = 0; shot < numShots; shot++) {
+        Position pos = take_shot(state);
+        if (binary) {
+            write_record(stdout, new_record(WIRE_GUESS, state->info.id, 
+                    state->game, pos));
+        } else {
+            char text[MAX_POSITION_LENGTH];
+            printf("%c%s", shot ? ',' : ' ', format_position(pos, text));
         }
-        printf("%c%d,%c", map.ships[ship].pos.col + 'A', 
-                map.ships[ship].pos.row + 1, map.ships[ship].dir);
     }
-    printf("\n");
+    if (!binary) {
+        printf("\n");
+    }
     fflush(stdout);
 }
 
@@ -214,16 +780,17 @@ void send_map_message(Map map) {
 void switch_mode(AgentState* state, Position pos, bool wasHit) {
 
     if (wasHit) {
-        Direction directions[4] = {DIR_NORTH, DIR_EAST, DIR_SOUTH, DIR_WEST};
-        for (int i = 0; i < sizeof(directions) / sizeof(Direction); i++) {
+        Direction directions[NUM_DIRECTIONS] = {DIR_NORTH, DIR_EAST, 
+                DIR_SOUTH, DIR_WEST};
+        for (int i = 0; i < NUM_DIRECTIONS; i++) {
             Position current = next_position_in_direction(pos, directions[i]);
             if (current.row < 0 || current.row > 
                     state->info.rules.numRows - 1 || current.col < 0 || 
                     current.col > state->info.rules.numCols - 1) {
                 continue; // out of bounds
             }
-            if (queue_in(&state->beenQueued, current) ||
-                    queue_in(&state->toAttack, current)) {
+            if (!add_to_set(&state->tracked, current.row * 
+                    state->info.rules.numCols + current.col)) {
                 continue; // position already tracked
             }
             add_queue(&state->toAttack, current);
@@ -237,106 +804,66 @@ void switch_mode(AgentState* state, Position pos, bool wasHit) {
 }
 
 /**
- * Read a hit message of either type HIT, SUNK, MISS.
+ * Read the rest of a hit message of either type HIT, SUNK, MISS, e.g. 
+ * "1,B3".
  *
- * state (AgentState): the state of the agent to be modified
- * message (char*): the line to read from
- * agent (int): the agent to be hitting
- * hit (HitType): the type of hit
+ * tokens (Tokenizer*): the message, after its tag and game id
+ * id (int*): the id of the player who guessed (to be modified)
+ * pos (Position*): the position guessed (to be modified)
  *
- * Returns READ_ERR if failed otherwise moves to next state.
+ * Returns AGENT_COMM_ERR if the message is invalid, otherwise AGENT_NORMAL.
  *
  */
-AgentStatus read_hit_message(AgentState* state, char* message, int agent, 
-        HitType hit) {
-    int index = 0;
-    if (hit == HIT_HIT) {
-        index += strlen("HIT ");
-    } else if (hit == HIT_SUNK) {
-        index += strlen("SUNK ");
-    } else if (hit == HIT_MISS) {
-        index += strlen("MISS ");
-    }
-
-    char col;
-    int id, row;
-    if (sscanf(message + index, "%d,%c%d", &id, &col, &row) != 3) {
+AgentStatus read_hit_message(Tokenizer* tokens, int* id, Position* pos) {
+    if (!take_int(tokens, id) || !take_char(tokens, ',') || 
+            !take_position(tokens, pos)) {
         return AGENT_COMM_ERR;
     }
-    if (id - 1 != agent) { // the wrong agent is hitting
-        return AGENT_COMM_ERR;
-    }
-    Position pos = new_position(col, row);
+    return AGENT_NORMAL;
+}
+
+/**
+ * Record the result of a guess in the hit maps and switch modes if needed.
+ *
+ * state (AgentState*): the state of the agent to be modified
+ * id (int): the id of the player who guessed
+ * pos (Position): the position guessed
+ * hit (HitType): the type of hit
+ *
+ */
+void record_hit(AgentState* state, int id, Position pos, HitType hit) {
     char data = hit;
     if (hit == HIT_SUNK) {
         data = HIT_HIT;
     }
     if (id == 1) {
-        update_hitmap(&state->hitMaps[1], pos, data);
+        update_agent_map(state, 1, pos, data);
     } else if (id == 2) {
-        update_hitmap(&state->hitMaps[0], pos, data);
+        update_agent_map(state, 0, pos, data);
+    }
+    if (id == state->info.id) {
+        mark_guessed(state, pos);
+        if (state->density != NULL) {
+            record_density(state->density, pos, hit);
+        }
     }
     if (hit == HIT_HIT) {
         if (id == state->info.id) {
             switch_mode(state, pos, true);
         }
-        fprintf(stderr, "HIT ");
     } else if (hit == HIT_SUNK) {
         if (id == state->info.id) {
             switch_mode(state, pos, true);
+            if (state->lattice != NULL) {
+                sink_on_lattice(state, pos);
+            }
             state->opponentShips--;
         } else {
             state->agentShips--;
         }
-        fprintf(stderr, "SHIP SUNK ");
-    } else if (hit == HIT_MISS) {
-        fprintf(stderr, "MISS ");
-        switch_mode(state, pos, false);
     } else {
         switch_mode(state, pos, false);
     }
-    fprintf(stderr, "player %d guessed %c%d\n", id, col, row);
-    free(message);
-    return AGENT_NORMAL;
-}
-
-/**
- * Read from stdin while in the READ_HIT state.
- *
- * state (AgentState): the current state of the agent
- * agent (int): this agent should be hitting
- *
- * Returns the next state.
- *
- */
-AgentStatus read_hit(AgentState* state, int agent) {
-    char* line;
-    if ((line = read_line(stdin)) == NULL) {
-        return AGENT_COMM_ERR; 
-    }
-    if (check_tag("HIT", line)) {
-        return read_hit_message(state, line, agent, HIT_HIT);
-    } else if (check_tag("SUNK", line)) {
-        return read_hit_message(state, line, agent, HIT_SUNK);
-    } else if (check_tag("MISS", line)) {
-        return read_hit_message(state, line, agent, HIT_MISS);
-    } else if (check_tag("EARLY", line)) {
-        agent_exit(AGENT_NORMAL, state);
-    } else if (check_tag("DONE", line)) {
-        int id;
-        if (check_tag("DONE", line)) {
-            if (sscanf(line, "DONE %d", &id) != 1) {
-                return AGENT_COMM_ERR;
-            }
-            if (id == 1 || id == 2) {
-                fprintf(stderr, "GAME OVER - player %d wins\n", id);
-                free(line);
-                agent_exit(AGENT_NORMAL, state);
-            }
-        }   
-    }
-    
-    return AGENT_COMM_ERR;
 }
 
 /**
@@ -369,15 +896,16 @@ AgentStatus read_id(char* message, int* id) {
  *
  */
 bool read_map_line(char* line, Map* map) {
-    int row;
-    char col, direction, dummy;
-    int scanCount = sscanf(line, "%c%d %c%c", &col, &row, &direction, &dummy);
-    
-    if (scanCount != 3 || !isdigit(line[1]) || !is_valid_row(row) ||
-            !is_valid_column(col) || !is_valid_direction(direction)) {
+    Tokenizer tokens = new_tokenizer(line);
+    Position pos;
+    char direction;
+    if (!take_position(&tokens, &pos) || !take_letter(&tokens, &direction) ||
+            !at_end(&tokens) || !is_valid_row(pos.row + 1) ||
+            !is_valid_column(pos.col + 1) || 
+            !is_valid_direction(direction)) {
         return false;
     }
-    add_ship(map, new_ship(0, new_position(col, row), (Direction) direction));
+    add_ship(map, new_ship(0, pos, (Direction) direction));
     return true;
 }
 
@@ -437,28 +965,37 @@ AgentStatus read_seed(char* message, int* seed) {
 /**
  * Read the RULES message from the hub.
  *
+ * message (char*): the message to read, without its game id
  * rules (Rules*): The rules struct to be modified.
  *
  * Returns AGENT_NORMAL if successful, otherwise returns a communication error.
  *
  */
-AgentStatus read_rules_message(Rules* rules) {
-    char* message;
-    if ((message = read_line(stdin)) == NULL) {
-        free(message);
-        return AGENT_COMM_ERR;
-    }
+AgentStatus read_rules_message(char* message, Rules* rules) {
     int index = 0;
     index += strlen("RULES "); // remove the tag
 
     int width, height, numShips;
-    if (sscanf(message + index, "%d,%d,%d", &width, &height, &numShips) != 3) {
-        free(message);
+    if (sscanf(message + index, "%d,%d,%d", &width, &height, &numShips) != 3 
+            || numShips < 1) {
         return AGENT_COMM_ERR;
     }
 
+    int salvo = 1; // only sent when more than one shot is taken each turn
+    char* salvoStart = strchr(message + index, ' ');
+    if (salvoStart != NULL) {
+        char dummy;
+        if (sscanf(salvoStart, " %d%c", &salvo, &dummy) != 1 || salvo < 1) {
+            return AGENT_COMM_ERR;
+        }
+        *salvoStart = '\0';
+    }
+
     int count = 0; // skipping past the first three commas
     while (count < 3) {
+        if (message[index] == '\0') {
+            return AGENT_COMM_ERR;
+        }
         if (message[index++] == ',') {
             count++;
         }
@@ -469,38 +1006,36 @@ AgentStatus read_rules_message(Rules* rules) {
     while (message[index] != '\0') {
         if (message[index] == ',') {
             ship++;
-        } else {
-            if (sscanf(message + index, "%d", &shipLengths[ship]) != 1) {
-                free(message);
-                return AGENT_COMM_ERR;
-            }
+        } else if (ship >= numShips || 
+                sscanf(message + index, "%d", &shipLengths[ship]) != 1) {
+            free(shipLengths);
+            return AGENT_COMM_ERR;
         }
         index++;
     }
 
-    free(message);
     if (ship != numShips - 1) {
+        free(shipLengths);
         return AGENT_COMM_ERR;
     }
 
     rules->numRows = height;
     rules->numCols = width;
     rules->numShips = numShips;
-    rules->shipLengths = malloc(sizeof(int) * numShips);
-    memcpy(rules->shipLengths, shipLengths, numShips * sizeof(*shipLengths));
-    free(shipLengths);
+    rules->shipLengths = shipLengths;
+    rules->salvo = salvo;
     return AGENT_NORMAL;
 }
 
 /**
  * Initialise the hitmaps of an agent
  *
- * state (AgentState): the agent state to be modified
+ * state (AgentState*): the agent state to be modified
  *
  */
-void initialise_hitmaps(AgentState state) {
-    update_ship_lengths(&state.info.rules, state.info.map);
-    mark_ships(&state.hitMaps[state.info.id - 1], state.info.map);
+void initialise_hitmaps(AgentState* state) {
+    update_ship_lengths(&state->info.rules, state->info.map);
+    mark_ships(&state->hitMaps[state->info.id - 1], state->info.map);
 }
 
 /**
@@ -521,111 +1056,428 @@ AgentState init_agent(AgentInfo info) {
             info.rules.numCols);
     newState.hitMaps[1] = empty_hitmap(info.rules.numRows, 
             info.rules.numCols);
+    newState.boards[0] = NULL;
+    newState.boards[1] = NULL;
     newState.info = info;
-    init_queue(&newState.toAttack);
-    init_queue(&newState.beenQueued);
+    newState.game = NO_GAME;
+    newState.turn = 0;
+    newState.salvoResults = 0;
+    // only our hits add to the queue, each at most the four cells around it
+    int shipCells = 0;
+    for (int i = 0; i < info.rules.numShips; i++) {
+        shipCells += info.rules.shipLengths[i];
+    }
+    init_queue(&newState.toAttack, 4 * shipCells);
+    init_cell_set(&newState.tracked, info.rules.numRows * 
+            info.rules.numCols, newState.hitMaps[0].sparse);
+    init_pool(&newState.unguessed, info.rules.numRows * info.rules.numCols,
+            newState.hitMaps[0].sparse);
+    newState.sweep = 0;
+    newState.lattice = NULL;
+    newState.density = NULL;
 
-    initialise_hitmaps(newState);
+    initialise_hitmaps(&newState);
     
     return newState;
 }
 
 /**
- * Read a YT message and exit appropriately.
+ * Print the maps for the agent to sderr. They are rendered the first time,
+ * and after that only kept up to date by update_agent_map().
+ *
+ * state (AgentState): the state of this agent
+ *
+ */
+void print_agent_maps(AgentState* state) {
+    if (state->info.id != 1 && state->info.id != 2) {
+        return;
+    }
+    for (int map = 0; map < NUM_AGENTS; map++) {
+        if (state->boards[map] == NULL) {
+            state->boards[map] = render_hitmap(state->hitMaps[map], false,
+                    &state->boardSizes[map]);
+        }
+    }
+    // our own map is printed first
+    int first = state->info.id - 1;
+    fwrite(state->boards[first], sizeof(char), state->boardSizes[first], 
+            stderr);
+    fprintf(stderr, "===\n");
+    fwrite(state->boards[1 - first], sizeof(char), 
+            state->boardSizes[1 - first], stderr);
+}
+
+/**
+ * Start a new game from a RULES message and answer with our MAP.
  *
- * state (AgentState*): this agent's state
- * checkOk (bool): should we be looking for OK message
+ * table (GameTable*): the games being played
+ * game (int): the id of the new game, or NO_GAME
+ * message (char*): the RULES message
  *
- * Returns true if YT, false if OK.
+ * Returns AGENT_NORMAL on success or AGENT_COMM_ERR.
  *
  */
-bool read_yt(AgentState* state, bool checkOk) {
-    char* next;
-    if ((next = read_line(stdin)) == NULL) {
-        free(next);
-        agent_exit(AGENT_COMM_ERR, state);
+AgentStatus handle_rules(GameTable* table, int game, char* message) {
+    int index = game == NO_GAME ? 0 : game;
+    if (index < 0 || find_game(table, game) != NULL) {
+        return AGENT_COMM_ERR;
     }
-    if (check_tag("YT", next)) {
-        free(next);
-        return true;
-    } else if (check_tag("EARLY", next)) {
-        free(next);
-        agent_exit(AGENT_NORMAL, state);
-    } else if (checkOk && check_tag("OK", next)) {
-        free(next);
+    AgentInfo info = table->info;
+    if (read_rules_message(message, &info.rules) != AGENT_NORMAL) {
+        return AGENT_COMM_ERR;
+    }
+    if (info.map.numShips < info.rules.numShips) {
+        free_rules(&info.rules);
+        return AGENT_COMM_ERR;
+    }
+    info.map = copy_map(table->info.map);
+    if (game != NO_GAME) {
+        // a shared agent is started with the seed of game 0, and each game
+        // gets the seed the hub would start an unshared agent with
+        info.seed += 2 * game;
+    }
+    send_map_message(info.map, game);
+
+    if (index >= table->size) {
+        int size = table->size ? table->size : 1;
+        while (size <= index) {
+            size *= 2;
+        }
+        table->games = realloc(table->games, sizeof(AgentState*) * size);
+        memset(table->games + table->size, 0, 
+                sizeof(AgentState*) * (size - table->size));
+        table->size = size;
+    }
+    AgentState* state = malloc(sizeof(AgentState));
+    *state = init_agent(info);
+    state->game = game;
+    table->games[index] = state;
+    table->playing++;
+
+    print_agent_maps(state);
+    return AGENT_NORMAL;
+}
+
+/**
+ * Record the result of a guess made in the current turn.
+ *
+ * state (AgentState*): the state of the game
+ * id (int): the id of the player who guessed
+ * pos (Position): the position guessed
+ * hit (HitType): the type of hit
+ *
+ * Returns AGENT_NORMAL on success or AGENT_COMM_ERR.
+ *
+ */
+AgentStatus record_result(AgentState* state, int id, Position pos, 
+        HitType hit) {
+    if (id - 1 != state->turn) { // the wrong agent is hitting
+        return AGENT_COMM_ERR;
+    }
+    record_hit(state, id, pos, hit);
+    if (hit == HIT_HIT) {
+        fprintf(stderr, "HIT ");
+    } else if (hit == HIT_SUNK) {
+        fprintf(stderr, "SHIP SUNK ");
+    } else if (hit == HIT_MISS) {
+        fprintf(stderr, "MISS ");
+    }
+    char text[MAX_POSITION_LENGTH];
+    fprintf(stderr, "player %d guessed %s\n", id, format_position(pos, text));
+    return AGENT_NORMAL;
+}
+
+/**
+ * Pass the turn on to the other player.
+ *
+ * state (AgentState*): the state of the game
+ *
+ */
+void end_turn(AgentState* state) {
+    state->salvoResults = 0;
+    state->turn = (state->turn + 1) % NUM_AGENTS;
+    if (state->turn == 0) {
+        print_agent_maps(state);
+    }
+}
+
+/**
+ * Record the result of a guess and pass the turn on, unless more results of
+ * a salvo are still to come.
+ *
+ * state (AgentState*): the state of the game
+ * id (int): the id of the player who guessed
+ * pos (Position): the position guessed
+ * hit (HitType): the type of hit
+ *
+ * Returns AGENT_NORMAL on success or AGENT_COMM_ERR.
+ *
+ */
+AgentStatus handle_result(AgentState* state, int id, Position pos, 
+        HitType hit) {
+    if (record_result(state, id, pos, hit) != AGENT_NORMAL) {
+        return AGENT_COMM_ERR;
+    }
+    if (state->salvoResults > 1) {
+        state->salvoResults--;
+    } else {
+        end_turn(state);
+    }
+    return AGENT_NORMAL;
+}
+
+/**
+ * Take the type of hit named in a SALVO message.
+ *
+ * tokens (Tokenizer*): the message to take from
+ * hit (HitType*): the type of hit (to be modified)
+ *
+ * Returns true if HIT, SUNK or MISS was taken, otherwise false.
+ *
+ */
+bool take_hit(Tokenizer* tokens, HitType* hit) {
+    if (take_word(tokens, "HIT")) {
+        *hit = HIT_HIT;
+    } else if (take_word(tokens, "SUNK")) {
+        *hit = HIT_SUNK;
+    } else if (take_word(tokens, "MISS")) {
+        *hit = HIT_MISS;
+    } else {
         return false;
-    } else if (check_tag("DONE", next)) {
-        int id;
-        if (check_tag("DONE", next)) {
-            if (sscanf(next, "DONE %d", &id) != 1) {
-                free(next);
-                return AGENT_COMM_ERR;
-            }
-            if (id == 1 || id == 2) {
-                fprintf(stderr, "GAME OVER - player %d wins\n", id);
-                free(next);
-                agent_exit(AGENT_NORMAL, state);
-            }
-        }   
     }
-    free(next);
-    agent_exit(AGENT_COMM_ERR, state);
-    return false;
+    return true;
 }
 
 /**
- * Print the maps for the agent to sderr
+ * Read the results of a salvo from a SALVO message, e.g.
+ * "SALVO 1,A1:HIT,B2:MISS,C3:SUNK", and pass the turn on.
  *
- * state (AgentState): the state of this agent
+ * state (AgentState*): the state of the game
+ * tokens (Tokenizer*): the message, after its tag and game id
+ *
+ * Returns AGENT_NORMAL on success or AGENT_COMM_ERR.
  *
  */
-void print_agent_maps(AgentState* state) {
-    if (state->info.id == 1) {
-        print_maps(state->hitMaps[0], state->hitMaps[1], stderr);
-    } else if (state->info.id == 2) {
-        print_maps(state->hitMaps[1], state->hitMaps[0], stderr);
+AgentStatus handle_salvo(AgentState* state, Tokenizer* tokens) {
+    int id;
+    if (!take_int(tokens, &id)) {
+        return AGENT_COMM_ERR;
     }
+    int numResults = 0;
+    while (take_char(tokens, ',')) {
+        Position pos;
+        HitType hit;
+        if (!take_position(tokens, &pos) || !take_char(tokens, ':') || 
+                !take_hit(tokens, &hit) || 
+                record_result(state, id, pos, hit) != AGENT_NORMAL) {
+            return AGENT_COMM_ERR;
+        }
+        numResults++;
+    }
+    if (numResults == 0 || !at_end(tokens)) {
+        return AGENT_COMM_ERR;
+    }
+    end_turn(state);
+    return AGENT_NORMAL;
 }
 
 /**
- * Run the main game loop for an agent.
+ * Read the result of a guess from a HIT, SUNK or MISS message.
  *
- * state (AgentState*): the state of this agent
+ * state (AgentState*): the state of the game
+ * tokens (Tokenizer*): the message, after its tag and game id
+ * hit (HitType): the type of hit
  *
- * Returns AGENT_NORMAL on success or a AGENT_COMM_ERR.
+ * Returns AGENT_NORMAL on success or AGENT_COMM_ERR.
  *
  */
-AgentStatus play_game(AgentState* state) {
-    AgentStatus status;
+AgentStatus handle_hit(AgentState* state, Tokenizer* tokens, HitType hit) {
+    int id;
+    Position pos;
+    if (read_hit_message(tokens, &id, &pos) != AGENT_NORMAL) {
+        return AGENT_COMM_ERR;
+    }
+    return handle_result(state, id, pos, hit);
+}
 
-    print_agent_maps(state);
-    while (true) {
-        for (int agent = 0; agent < NUM_AGENTS; agent++) {
-            bool check_ok = false;
-            while (true) {
-                if (state->info.id - 1 == agent) {
-                    bool got_yt = read_yt(state, check_ok);
-                    if (!got_yt) {
-                        break; // we got OK   
-                    }
-                    make_guess(state);
-                    check_ok = true; // look for OK now
-                } else {
-                    break;
-                }
-            }
+/**
+ * End a game won by the given player.
+ *
+ * table (GameTable*): the games being played
+ * game (int): the id of the game, or NO_GAME
+ * id (int): the id of the winner
+ *
+ * Returns AGENT_NORMAL on success or AGENT_COMM_ERR.
+ *
+ */
+AgentStatus finish_game(GameTable* table, int game, int id) {
+    if ((id != 1 && id != 2) || find_game(table, game) == NULL) {
+        return AGENT_COMM_ERR;
+    }
+    fprintf(stderr, "GAME OVER - player %d wins\n", id);
+    remove_game(table, game);
+    if (game == NO_GAME) {
+        agent_exit(AGENT_NORMAL, table); // our only game is over
+    }
+    return AGENT_NORMAL;
+}
 
-            if ((status = read_hit(state, agent)) != AGENT_NORMAL) {
-                return status;
-            }
+/**
+ * Read a DONE message, ending the game.
+ *
+ * table (GameTable*): the games being played
+ * game (int): the id of the game, or NO_GAME
+ * tokens (Tokenizer*): the message, after its tag and game id
+ *
+ * Returns AGENT_NORMAL on success or AGENT_COMM_ERR.
+ *
+ */
+AgentStatus handle_done(GameTable* table, int game, Tokenizer* tokens) {
+    int id;
+    if (!take_int(tokens, &id)) {
+        return AGENT_COMM_ERR;
+    }
+    return finish_game(table, game, id);
+}
+
+/**
+ * Handle a message from the hub, passing it to the game it belongs to.
+ *
+ * table (GameTable*): the games being played
+ * message (char*): the message to handle, which may be modified
+ *
+ * Returns AGENT_NORMAL on success or AGENT_COMM_ERR.
+ *
+ */
+AgentStatus handle_message(GameTable* table, char* message) {
+    Tokenizer tokens = new_tokenizer(message);
+    if (take_word(&tokens, "BINARY")) { // every later message is a record
+        printf("BINARY\n");
+        fflush(stdout);
+        table->binary = true;
+        return AGENT_NORMAL;
+    } else if (take_word(&tokens, "RULES")) {
+        int game = take_game_id(message);
+        return handle_rules(table, game, message);
+    } else if (take_word(&tokens, "EARLY")) {
+        agent_exit(AGENT_NORMAL, table);
+    }
 
-            if (agent == NUM_AGENTS - 1) {
-                print_agent_maps(state);
+    // the game id follows the tag, so skip over the tag to find the game
+    // and match it once the game is known
+    Tokenizer tag = tokens;
+    while (isalpha(*tokens.next)) {
+        tokens.next++;
+    }
+    int game = take_game(&tokens);
+    AgentState* state = find_game(table, game);
+    if (state == NULL) {
+        return AGENT_COMM_ERR;
+    }
+    bool ourTurn = state->turn == state->info.id - 1;
+    if (take_word(&tag, "YT") && ourTurn) {
+        send_guess_message(state, false);
+    } else if (take_word(&tag, "OK") && ourTurn) {
+        return AGENT_NORMAL;
+    } else if (take_word(&tag, "HIT")) {
+        return handle_hit(state, &tokens, HIT_HIT);
+    } else if (take_word(&tag, "SUNK")) {
+        return handle_hit(state, &tokens, HIT_SUNK);
+    } else if (take_word(&tag, "MISS")) {
+        return handle_hit(state, &tokens, HIT_MISS);
+    } else if (take_word(&tag, "SALVO")) {
+        return handle_salvo(state, &tokens);
+    } else if (take_word(&tag, "DONE")) {
+        return handle_done(table, game, &tokens);
+    } else {
+        return AGENT_COMM_ERR;
+    }
+    return AGENT_NORMAL;
+}
+
+/**
+ * Handle a record of the binary protocol from the hub, passing it to the
+ * game it belongs to.
+ *
+ * table (GameTable*): the games being played
+ * record (WireRecord): the record to handle
+ *
+ * Returns AGENT_NORMAL on success or AGENT_COMM_ERR.
+ *
+ */
+AgentStatus handle_record(GameTable* table, WireRecord record) {
+    AgentState* state = find_game(table, record.game);
+    if (state == NULL) {
+        return AGENT_COMM_ERR;
+    }
+    bool ourTurn = state->turn == state->info.id - 1;
+    switch (record.type) {
+        case WIRE_YT:
+            if (!ourTurn) {
+                return AGENT_COMM_ERR;
             }
+            send_guess_message(state, true);
+            return AGENT_NORMAL;
+        case WIRE_OK:
+            return ourTurn ? AGENT_NORMAL : AGENT_COMM_ERR;
+        case WIRE_HIT:
+            return handle_result(state, record.player, record.pos, HIT_HIT);
+        case WIRE_SUNK:
+            return handle_result(state, record.player, record.pos, HIT_SUNK);
+        case WIRE_MISS:
+            return handle_result(state, record.player, record.pos, HIT_MISS);
+        case WIRE_SALVO:
+            if (record.player - 1 != state->turn || record.pos.row < 1) {
+                return AGENT_COMM_ERR;
+            }
+            state->salvoResults = record.pos.row;
+            return AGENT_NORMAL;
+        case WIRE_DONE:
+            return finish_game(table, record.game, record.player);
+        default:
+            return AGENT_COMM_ERR;
+    }
+}
+
+/**
+ * Run the main loop for an agent, playing every game the hub starts until
+ * the hub closes our input. Input is read in large chunks and handled a
+ * line (or record) at a time straight out of the buffer.
+ *
+ * table (GameTable*): the games being played
+ *
+ * Returns AGENT_NORMAL on success or a AGENT_COMM_ERR.
+ *
+ */
+AgentStatus play_games(GameTable* table) {
+    LineBuffer input = empty_line_buffer();
+    AgentStatus status = AGENT_NORMAL;
+    bool started = false;
+    while (status == AGENT_NORMAL) {
+        char* message;
+        WireRecord record;
+        if (table->binary && next_buffered_record(&input, &record)) {
+            status = handle_record(table, record);
+        } else if (!table->binary && 
+                (message = next_buffered_line(&input)) != NULL) {
+            status = handle_message(table, message);
+            started = true;
+        } else if (fill_line_buffer(&input, STDIN_FILENO) <= 0) {
+            break;
         }
     }
+    free_line_buffer(&input);
+    if (status != AGENT_NORMAL) {
+        return status;
+    }
+    // a hub sharing us between games closes our input when it is done
+    if (!started || table->playing > 0) {
+        return AGENT_COMM_ERR;
+    }
+    return AGENT_NORMAL;
 }
 
+#ifndef AGENT_PLUGIN
 int main(int argc, char** argv) {
     if (argc != 4) {
         agent_exit(AGENT_INCORRECT_ARG_COUNT, NULL);
@@ -646,14 +1498,11 @@ int main(int argc, char** argv) {
     if ((status = read_seed(argv[3], &seed)) != AGENT_NORMAL) {
         agent_exit(status, NULL);
     }
-    srand(seed); // seeding the random number generator
-
-    if ((status = read_rules_message(&info.rules)) != AGENT_NORMAL) {
-        agent_exit(status, NULL);
-    }
-    send_map_message(info.map);
+    info.seed = seed; // seeding the random number generator
 
-    AgentState state = init_agent(info);
-    status = play_game(&state);
-    agent_exit(status, &state);
+    GameTable table;
+    init_game_table(&table, info);
+    status = play_games(&table);
+    agent_exit(status, &table);
 }
+#endif
@@ -1,25 +1,115 @@
 #include "game.h"
+#include "density.h"
 
 #ifndef AGENT_H
 #define AGENT_H
 
-/* Nodes containing Positions */
-struct Node {
-    Position pos;
-    struct Node* next;
-};
-
-/* A queue containing positions */
+/**
+ * A queue of positions, kept in a ring buffer allocated once so that
+ * adding and taking positions never allocates.
+ *
+ * - positions: the buffer
+ * - head: the index of the first position in the buffer
+ * - size: the number of positions in the queue
+ * - capacity: the number of positions the buffer holds
+ */
 typedef struct Queue {
-    struct Node* head;
-    struct Node* tail;
+    Position* positions;
+    int head;
+    int size;
+    int capacity;
 } Queue;
 
 /* Queue methods */
-void init_queue(Queue* q);
+void init_queue(Queue* q, int capacity);
 void free_queue(Queue* q);
 void add_queue(Queue* q, Position pos);
 Position get_queue(Queue* q);
+bool is_empty(Queue q);
+
+/**
+ * A set of the cells of a board, one bit to a cell, or only the cells added
+ * on sparse boards.
+ *
+ * - bits: bit i % 64 of word i / 64 is set if cell i is in the set, NULL
+ *   for sparse boards
+ * - cells: for sparse boards, 1 for each cell in the set
+ * - sparse: is cells used instead of bits
+ */
+typedef struct CellSet {
+    uint64_t* bits;
+    CellTable cells;
+    bool sparse;
+} CellSet;
+
+/* Cell set methods */
+void init_cell_set(CellSet* set, int numCells, bool sparse);
+void free_cell_set(CellSet* set);
+bool add_to_set(CellSet* set, int cell);
+
+/**
+ * The cells of a board that have not been guessed, kept so that a random
+ * one can be taken in O(1) however full the board is. The first size
+ * entries of the pool are the unguessed cells; a guessed cell is swapped
+ * out to just past them. Every entry starts as its own cell.
+ *
+ * - cells: the cell at each entry of the pool, NULL for sparse boards
+ * - places: the entry of the pool holding each cell, NULL for sparse boards
+ * - movedCells: for sparse boards, one more than the cell at each entry
+ *   that has moved, so that only guessed cells take memory
+ * - movedPlaces: for sparse boards, one more than the entry of each cell
+ *   that has moved
+ * - sparse: are movedCells and movedPlaces used instead of the arrays
+ * - size: the number of unguessed cells
+ */
+typedef struct CellPool {
+    int* cells;
+    int* places;
+    CellTable movedCells;
+    CellTable movedPlaces;
+    bool sparse;
+    int size;
+} CellPool;
+
+/* Cell pool methods */
+void init_pool(CellPool* pool, int numCells, bool sparse);
+void free_pool(CellPool* pool);
+void remove_from_pool(CellPool* pool, int cell);
+int random_from_pool(CellPool* pool, unsigned int* seed);
+
+/**
+ * The cells worth searching while no ship is being attacked: those with
+ * (row + col) % spacing == 0. Every ship at least spacing long covers one
+ * of them however it lies, so spacing is kept at the shortest length of the
+ * ships thought to be afloat.
+ *
+ * - lengths: each distinct ship length of the rules, shortest first
+ * - afloat: the number of ships of each length not thought to be sunk
+ * - numLengths: the number of distinct ship lengths
+ * - shortest: the index in lengths of the shortest ship afloat
+ * - spacing: the spacing of the lattice
+ * - rows: the number of rows of the board
+ * - cols: the number of columns of the board
+ * - width: the most cells of a row on the lattice, so that lattice cell j
+ *   of row r has index r * width + j
+ * - cells: the indices of the cells on the lattice we have not guessed
+ */
+typedef struct Lattice {
+    int* lengths;
+    int* afloat;
+    int numLengths;
+    int shortest;
+    int spacing;
+    int rows;
+    int cols;
+    int width;
+    CellPool cells;
+} Lattice;
+
+/* Lattice methods */
+Lattice* new_lattice(Rules rules);
+void free_lattice(Lattice* lattice);
+bool on_lattice(Lattice* lattice, Position pos);
 
 /* Exit codes for the agent as per the specification */
 typedef enum {
@@ -37,11 +127,13 @@ typedef enum {
  * - id: the id for this agent
  * - rules: the rules of this game
  * - map: the map of this agent
+ * - seed: the state of the random number generator for this game
  */
 typedef struct AgentInfo {
     int id;
     Rules rules;
     Map map;
+    unsigned int seed;
 } AgentInfo;
 
 /**
@@ -49,37 +141,95 @@ typedef struct AgentInfo {
  *
  * - info: the agent info
  * - hitMaps[]: the hitmaps of each player
+ * - boards[]: the text of each hitmap as printed, NULL until first printed,
+ *   after which only the cells that change are rewritten
+ * - boardSizes[]: the length of the text of each board
  * - opponentShips: the number of ships the opponent has
  * - agentShips: the number of ships this agent has
  * - mode: the mode of the agent (only applies to agent B)
  * - toAttack: a FIFO data structure containing positions to attack
- * - beenQueued: keeping track of the positions we have visited in attack
+ * - tracked: the cells of the opponent's board we have guessed or queued
+ *   to attack
+ * - unguessed: the cells of the opponent's board we have not guessed
+ * - lattice: the cells of the opponent's board searched while no ship is
+ *   being attacked, NULL until the first guess (only applies to agent B)
+ * - sweep: the cell agent A guessed last, where its sweep of the opponent's
+ *   board carries on from (only applies to agent A)
+ * - density: where the opponent's ships can still be, NULL until the first
+ *   guess (only applies to agent C)
+ * - game: the id of the game in messages, NO_GAME if there is none
+ * - turn: the index of the agent whose guess result comes next
+ * - salvoResults: the number of results of a salvo still to come, when 
+ *   announced by a SALVO record
  */
 typedef struct AgentState {
     AgentInfo info;
     HitMap hitMaps[2];
+    char* boards[2];
+    size_t boardSizes[2];
     int opponentShips;
     int agentShips;
     AgentMode mode;
-    struct Queue toAttack;
-    struct Queue beenQueued;
+    Queue toAttack;
+    CellSet tracked;
+    CellPool unguessed;
+    Lattice* lattice;
+    int sweep;
+    DensityMap* density;
+    int game;
+    int turn;
+    int salvoResults;
 } AgentState;
 
+/**
+ * The games being played by an agent, indexed by game id (a game without
+ * an id is stored at index 0).
+ *
+ * - info: the id and map that every game is started with
+ * - games: the state of each game, NULL where no game is being played
+ * - size: the number of entries in games
+ * - playing: the number of games being played
+ * - binary: has the hub switched us to the binary protocol
+ */
+typedef struct GameTable {
+    AgentInfo info;
+    AgentState** games;
+    int size;
+    int playing;
+    bool binary;
+} GameTable;
+
 /* Exit from the program */
-void agent_exit(AgentStatus err, AgentState* state);
+void agent_exit(AgentStatus err, GameTable* table);
 void free_agent_state(AgentState* state);
 
+/* Game table */
+void init_game_table(GameTable* table, AgentInfo info);
+AgentState* find_game(GameTable* table, int game);
+void remove_game(GameTable* table, int game);
+void free_game_table(GameTable* table);
+
 /* Message parsing */
-AgentStatus read_message(AgentState* state, char* message);
-AgentStatus read_rules_message(Rules* rules);
-AgentStatus read_hit_message(AgentState* state, char* message, int agent, 
-        HitType hit);
+AgentStatus handle_message(GameTable* table, char* message);
+AgentStatus read_rules_message(char* message, Rules* rules);
+AgentStatus read_hit_message(Tokenizer* tokens, int* id, Position* pos);
+AgentStatus handle_record(GameTable* table, WireRecord record);
+void record_hit(AgentState* state, int id, Position pos, HitType hit);
+void update_agent_map(AgentState* state, int map, Position pos, char data);
 
 /* Message sending */
-void send_map_message(Map map);
-void make_guess(AgentState* state);
+void send_map_message(Map map, int game);
+void send_guess_message(AgentState* state, bool binary);
+Position take_shot(AgentState* state);
+
+/* Searching */
+int random_on_lattice(AgentState* state);
+
+/* Strategy, provided by each agent */
+Position make_guess(AgentState* state);
 
 AgentStatus read_map_file(char* filepath, Map* map);
-void initialise_hitmaps(AgentState state);
+void initialise_hitmaps(AgentState* state);
+AgentState init_agent(AgentInfo info);
 
 #endif
@@ -7,43 +7,36 @@
 #include <string.h>
 
 /**
- * Make a guess following the algorithm designed on the specification.
+ * Make a guess following the algorithm designed on the specification: the
+ * first row with no guess is swept left to right if it is even and right
+ * to left if it is odd.
+ *
+ * Cells are only ever filled in, so the sweep carries on from the cell
+ * guessed last rather than searching the whole map again.
  *
  * state (AgentState*): the state of this agent
  *
+ * Returns the position to guess.
+ *
  */
-void make_guess(AgentState* state) {
-    int opponent;
-    if (state->info.id == 1) {
-        opponent = 1;
-    } else {
-        opponent = 0;
-    }
-    
-    int topMost; // find the top most row with no guess
-    for (int i = 0; i < strlen(state->hitMaps[opponent].data); i++) {
-        if (state->hitMaps[opponent].data[i] == HIT_NONE) {
-            topMost = i;
-            break;
-        }
-    }
+Position make_guess(AgentState* state) {
+    HitMap map = state->hitMaps[state->info.id % NUM_AGENTS];
+    // the cells before the last guess in an even row have been guessed,
+    // but in an odd row only those after it
+    int row = state->sweep / map.cols;
+    int from = row % 2 ? map.cols * row : state->sweep;
 
-    int row = topMost / state->hitMaps[opponent].rows;
-    printf("GUESS ");
-    if (row % 2) {
+    // find the top most row with no guess
+    int cell = next_open_cell(map, from);
+    if (cell < 0) {
+        return (Position) {0, 0};
+    }
+    if ((cell / map.cols) % 2) {
         // find the rightmost with no guess
-        int rightMostCol = state->hitMaps[opponent].cols;
-        for (int i = rightMostCol - 1; i >= 0; i--) {
-            if (state->hitMaps[opponent].data[state->info.rules.numCols * 
-                    row + i] == HIT_NONE) {
-                rightMostCol = i;
-                break;
-            }
-        }
-        printf("%c%d\n", rightMostCol + 'A', row + 1);
-    } else {
-        printf("%c%d\n", (topMost % state->hitMaps[opponent].cols) + 'A',
-                row + 1);
+        int last = cell / map.cols == row ? state->sweep :
+                map.cols * (cell / map.cols) + map.cols - 1;
+        cell = prev_open_cell(map, last);
     }
-    fflush(stdout);
+    state->sweep = cell;
+    return (Position) {cell / map.cols, cell % map.cols};
 }
@@ -5,18 +5,21 @@
 #include <stdlib.h>
 
 /**
- * Generate a position in SEARCH mode.
+ * Generate a position in SEARCH mode: one of the cells on the lattice of the
+ * shortest ship afloat not yet guessed, each with the same chance.
  *
- * width (int): the width of the board
- * height (int): the height of the board
+ * state (AgentState*): the state of this agent
  *
  * Returns a Position generated based on the algorithm.
  *
  */
-Position generate_position(int width, int height) {
-    int row = rand() % height;
-    int col = rand() % width;
-    Position result = {row, col};
+Position generate_position(AgentState* state) {
+    int width = state->info.rules.numCols;
+    int cell = random_on_lattice(state);
+    if (cell < 0) {
+        cell = 0; // every cell has been guessed
+    }
+    Position result = {cell / width, cell % width};
     return result;
 }
 
@@ -25,26 +28,20 @@ Position generate_position(int width, int height) {
  *
  * state (AgentState*): the state of this agent
  *
+ * Returns the position to guess.
+ *
  */
-void make_guess(AgentState* state) {
-    int opponent;
-    if (state->info.id == 1) {
-        opponent = 1;
-    } else {
-        opponent = 0;
-    }
-
+Position make_guess(AgentState* state) {
     Position pos;
+    if (state->mode == ATTACK && is_empty(state->toAttack)) {
+        state->mode = SEARCH; // every neighbour has already been guessed
+    }
     if (state->mode == SEARCH) {
-        pos = generate_position(state->hitMaps[opponent].cols, 
-                state->hitMaps[opponent].rows);
-        while (get_position_info(state->hitMaps[opponent], pos) != HIT_NONE) {
-            pos = generate_position(state->hitMaps[opponent].cols, 
-                    state->hitMaps[opponent].rows);
-        }
+        pos = generate_position(state);
     } else if (state->mode == ATTACK) {
         pos = get_queue(&state->toAttack);
     }
-    add_queue(&state->beenQueued, pos);
-    printf("GUESS %c%d\n", pos.col + 'A', pos.row + 1);;
+    add_to_set(&state->tracked, pos.row * state->info.rules.numCols + 
+            pos.col);
+    return pos;
 }
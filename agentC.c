@@ -0,0 +1,38 @@
+#include "agent.h"
+#include "game.h"
+#include "density.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/**
+ * Make a guess at the cell where the ships afloat are most likely to be.
+ * While a ship has been hit but not sunk, the cell covered by the most
+ * placements over its hits is shot at. Otherwise the densest cell is, or a
+ * random cell not yet guessed on sparse boards (where the density is flat
+ * away from the edges and misses) or if no ship afloat fits anywhere.
+ *
+ * state (AgentState*): the state of this agent
+ *
+ * Returns the position to guess.
+ *
+ */
+Position make_guess(AgentState* state) {
+    if (state->density == NULL) {
+        state->density = new_density_map(state->info.rules);
+    }
+    HitMap* map = &state->hitMaps[state->info.id % NUM_AGENTS];
+    int cell = target_cell(state->density, map);
+    if (cell < 0) {
+        cell = densest_cell(state->density);
+    }
+    if (cell < 0) {
+        cell = random_from_pool(&state->unguessed, &state->info.seed);
+    }
+    if (cell < 0) {
+        cell = 0; // every cell has been guessed
+    }
+    claim_cell(state->density, cell);
+    Position pos = {cell / map->cols, cell % map->cols};
+    return pos;
+}
@@ -0,0 +1,678 @@
+#include "agent.h"
+#include "game.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <getopt.h>
+
+#include "plugin.h"
+
+/* How long each sample of a benchmark runs for */
+#define SAMPLE_NS 10000000L
+
+/* The number of samples taken of each benchmark */
+#define NUM_SAMPLES 5
+
+/* How much slower than its baseline a benchmark may be before it counts as
+ * a regression, as long as the difference is also beyond the noise */
+#define REGRESSION_TOLERANCE 0.10
+
+/* The length of every ship of a generated fleet */
+#define FLEET_SHIP_LENGTH 3
+
+/* Exit codes for the benchmarks */
+typedef enum {
+    BENCH_NORMAL,
+    BENCH_USAGE,
+    BENCH_BAD_BASELINE,
+    BENCH_REGRESSION
+} BenchStatus;
+
+/* Runs a benchmark for the given number of operations */
+typedef void (*BenchFunction)(void* context, long ops);
+
+/**
+ * A result read from a baseline file.
+ * - name: the name and parameters of the benchmark, separated by a tab
+ * - nsPerOp: the mean time of an operation
+ * - stddev: the standard deviation of the samples
+ */
+typedef struct BaselineEntry {
+    char* name;
+    double nsPerOp;
+    double stddev;
+} BaselineEntry;
+
+/**
+ * The results of an earlier run to compare against.
+ * - entries: the results, NULL if there is no baseline
+ * - numEntries: the number of results
+ * - regressions: the number of benchmarks found to have regressed
+ */
+typedef struct Baseline {
+    BaselineEntry* entries;
+    int numEntries;
+    int regressions;
+} Baseline;
+
+/**
+ * A board and fleet for benchmarks of the game state.
+ * - rules: the size of the board and the lengths of the ships
+ * - map: the fleet, with its occupancy grid built
+ * - hitmap: the hit map being shot at
+ * - order: every cell of the board in a shuffled order
+ * - next: the next cell of order to shoot at
+ */
+typedef struct BoardContext {
+    Rules rules;
+    Map map;
+    HitMap hitmap;
+    int* order;
+    int next;
+} BoardContext;
+
+/**
+ * An agent strategy playing against a fleet for the make_guess benchmarks.
+ * - plugin: the strategy
+ * - handle: the agent, restarted whenever its game is over
+ * - mapPath: the map file the agent is started with
+ * - board: the fleet being shot at
+ */
+typedef struct StrategyContext {
+    const AgentPlugin* plugin;
+    void* handle;
+    char* mapPath;
+    BoardContext* board;
+} StrategyContext;
+
+/**
+ * Gets the current time.
+ *
+ * Returns the time in nanoseconds from an arbitrary point.
+ *
+ */
+long now_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+/**
+ * Exit the benchmarks, printing the message for the given status.
+ *
+ * status (BenchStatus): the status to exit with
+ *
+ */
+void bench_exit(BenchStatus status) {
+    switch (status) {
+        case BENCH_USAGE:
+            fprintf(stderr, "Usage: 2310bench [--baseline file]\n");
+            break;
+        case BENCH_BAD_BASELINE:
+            fprintf(stderr, "Error reading baseline\n");
+            break;
+        case BENCH_REGRESSION:
+            fprintf(stderr, "Benchmarks regressed\n");
+            break;
+        default:
+            break;
+    }
+    exit(status);
+}
+
+/**
+ * Read the results of an earlier run, as printed by run_benchmark().
+ *
+ * path (char*): the location of the results
+ * baseline (Baseline*): the results read (to be modified)
+ *
+ * Returns true if successful, else returns false.
+ *
+ */
+bool read_baseline(char* path, Baseline* baseline) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    char* line;
+    while ((line = read_line(file)) != NULL) {
+        char* name = strtok(line, "\t");
+        char* params = strtok(NULL, "\t");
+        char* mean = strtok(NULL, "\t");
+        char* stddev = strtok(NULL, "\t");
+        if (name == NULL || name[0] == '#' || stddev == NULL) {
+            free(line);
+            continue;
+        }
+        baseline->entries = realloc(baseline->entries,
+                sizeof(BaselineEntry) * (baseline->numEntries + 1));
+        BaselineEntry* entry = &baseline->entries[baseline->numEntries++];
+        entry->name = malloc(strlen(name) + strlen(params) + 2);
+        sprintf(entry->name, "%s\t%s", name, params);
+        entry->nsPerOp = strtod(mean, NULL);
+        entry->stddev = strtod(stddev, NULL);
+        free(line);
+    }
+    fclose(file);
+    return true;
+}
+
+/**
+ * Find the baseline result of a benchmark.
+ *
+ * baseline (Baseline*): the results of the earlier run
+ * name (char*): the name of the benchmark
+ * params (char*): the parameters of the benchmark
+ *
+ * Returns the result, or NULL if the benchmark is not in the baseline.
+ *
+ */
+BaselineEntry* find_baseline(Baseline* baseline, char* name, char* params) {
+    for (int i = 0; i < baseline->numEntries; i++) {
+        char* entry = baseline->entries[i].name;
+        size_t length = strlen(name);
+        if (strncmp(entry, name, length) == 0 && entry[length] == '\t' &&
+                strcmp(entry + length + 1, params) == 0) {
+            return &baseline->entries[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Time a benchmark and print a line of results: its name, parameters,
+ * mean ns/op, the standard deviation of the samples and the number of
+ * samples, separated by tabs. With a baseline, the baseline ns/op and the
+ * change follow, and REGRESSION if it has slowed by more than both the
+ * tolerance and the noise of the two runs.
+ *
+ * name (char*): the name of the benchmark
+ * params (char*): the parameters of the benchmark
+ * run (BenchFunction): the benchmark
+ * context (void*): the state given to the benchmark
+ * baseline (Baseline*): the results of an earlier run
+ *
+ */
+void run_benchmark(char* name, char* params, BenchFunction run,
+        void* context, Baseline* baseline) {
+    // Find how many operations fill a sample
+    long ops = 1;
+    long elapsed;
+    while (true) {
+        long start = now_ns();
+        run(context, ops);
+        elapsed = now_ns() - start;
+        if (elapsed >= SAMPLE_NS / 10) {
+            break;
+        }
+        ops *= 2;
+    }
+    ops = ops * SAMPLE_NS / (elapsed > 0 ? elapsed : 1) + 1;
+
+    double samples[NUM_SAMPLES];
+    double mean = 0;
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        long start = now_ns();
+        run(context, ops);
+        samples[i] = (double) (now_ns() - start) / ops;
+        mean += samples[i] / NUM_SAMPLES;
+    }
+    double variance = 0;
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        variance += (samples[i] - mean) * (samples[i] - mean) / NUM_SAMPLES;
+    }
+    double stddev = sqrt(variance);
+
+    printf("%s\t%s\t%.2f\t%.2f\t%d", name, params, mean, stddev,
+            NUM_SAMPLES);
+    BaselineEntry* entry = find_baseline(baseline, name, params);
+    if (entry != NULL) {
+        double change = (mean - entry->nsPerOp) / entry->nsPerOp;
+        printf("\t%.2f\t%+.1f%%", entry->nsPerOp, 100 * change);
+        if (change > REGRESSION_TOLERANCE &&
+                mean - entry->nsPerOp > 3 * (stddev + entry->stddev)) {
+            printf("\tREGRESSION");
+            baseline->regressions++;
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+/**
+ * Generate rules and a fleet for a board, with the ships laid end to end
+ * along every other row.
+ *
+ * board (BoardContext*): the board to set up
+ * rows (int): the number of rows
+ * cols (int): the number of columns
+ * numShips (int): the number of ships
+ *
+ * Returns true if the fleet fits on the board, else returns false.
+ *
+ */
+bool init_board(BoardContext* board, int rows, int cols, int numShips) {
+    int perRow = cols / (FLEET_SHIP_LENGTH + 1);
+    if ((long) perRow * ((rows + 1) / 2) < numShips) {
+        return false;
+    }
+    board->rules.numRows = rows;
+    board->rules.numCols = cols;
+    board->rules.numShips = numShips;
+    board->rules.salvo = 1;
+    board->rules.shipLengths = malloc(sizeof(int) * numShips);
+    board->map = empty_map();
+    for (int i = 0; i < numShips; i++) {
+        board->rules.shipLengths[i] = FLEET_SHIP_LENGTH;
+        Position pos = {2 * (i / perRow),
+                (i % perRow) * (FLEET_SHIP_LENGTH + 1)};
+        add_ship(&board->map, new_ship(0, pos, DIR_EAST));
+    }
+    update_ship_lengths(&board->rules, board->map);
+    build_occupancy(&board->map, board->rules);
+    board->hitmap = empty_hitmap(rows, cols);
+
+    int numCells = rows * cols;
+    unsigned int seed = 1;
+    board->order = malloc(sizeof(int) * numCells);
+    for (int cell = 0; cell < numCells; cell++) {
+        board->order[cell] = cell;
+    }
+    for (int cell = numCells - 1; cell > 0; cell--) {
+        int other = rand_r(&seed) % (cell + 1);
+        int swap = board->order[cell];
+        board->order[cell] = board->order[other];
+        board->order[other] = swap;
+    }
+    board->next = 0;
+    return true;
+}
+
+/**
+ * Start the game on a board again, with no shots taken.
+ *
+ * board (BoardContext*): the board to reset
+ *
+ */
+void reset_board(BoardContext* board) {
+    free_hitmap(&board->hitmap);
+    board->hitmap = empty_hitmap(board->rules.numRows, board->rules.numCols);
+    update_ship_lengths(&board->rules, board->map);
+    build_occupancy(&board->map, board->rules);
+    board->next = 0;
+}
+
+/**
+ * Free the memory of a board.
+ *
+ * board (BoardContext*): the board to be freed
+ *
+ */
+void free_board(BoardContext* board) {
+    free_rules(&board->rules);
+    free_map(&board->map);
+    free_hitmap(&board->hitmap);
+    free(board->order);
+}
+
+/**
+ * Benchmark mark_ship_hit(), shooting at every cell of the board in a
+ * random order and starting again once every cell is shot.
+ *
+ * context (void*): the board
+ * ops (long): the number of shots
+ *
+ */
+void bench_mark_ship_hit(void* context, long ops) {
+    BoardContext* board = context;
+    int numCells = board->rules.numRows * board->rules.numCols;
+    for (long op = 0; op < ops; op++) {
+        if (board->next == numCells) {
+            reset_board(board);
+        }
+        int cell = board->order[board->next++];
+        Position pos = {cell / board->rules.numCols,
+                cell % board->rules.numCols};
+        mark_ship_hit(&board->hitmap, &board->map, pos);
+    }
+}
+
+/**
+ * Benchmark all_ships_sunk().
+ *
+ * context (void*): the board
+ * ops (long): the number of calls
+ *
+ */
+void bench_all_ships_sunk(void* context, long ops) {
+    BoardContext* board = context;
+    volatile bool sunk;
+    for (long op = 0; op < ops; op++) {
+        sunk = all_ships_sunk(board->map);
+    }
+    (void) sunk;
+}
+
+/**
+ * Benchmark validate_info() on a pair of the board's fleets.
+ *
+ * context (void*): the game info to validate
+ * ops (long): the number of validations
+ *
+ */
+void bench_validate_info(void* context, long ops) {
+    for (long op = 0; op < ops; op++) {
+        validate_info(context);
+    }
+}
+
+/**
+ * Benchmark print_hitmap() on the board, written to /dev/null.
+ *
+ * context (void*): the board
+ * ops (long): the number of boards printed
+ *
+ */
+void bench_print_hitmap(void* context, long ops) {
+    BoardContext* board = context;
+    FILE* out = fopen("/dev/null", "w");
+    for (long op = 0; op < ops; op++) {
+        print_hitmap(board->hitmap, out, false);
+    }
+    fclose(out);
+}
+
+/**
+ * Benchmark read_line() on short messages.
+ *
+ * context (void*): the text of the messages, terminated
+ * ops (long): the number of lines read
+ *
+ */
+void bench_read_line(void* context, long ops) {
+    char* text = context;
+    FILE* stream = fmemopen(text, strlen(text), "r");
+    for (long op = 0; op < ops; op++) {
+        char* line = read_line(stream);
+        if (line == NULL) {
+            rewind(stream);
+            line = read_line(stream);
+        }
+        free(line);
+    }
+    fclose(stream);
+}
+
+/**
+ * Benchmark add_queue() followed by get_queue().
+ *
+ * context (void*): the queue
+ * ops (long): the number of positions added and taken
+ *
+ */
+void bench_queue_add_get(void* context, long ops) {
+    Queue* queue = context;
+    Position pos = {0, 0};
+    for (long op = 0; op < ops; op++) {
+        add_queue(queue, pos);
+        pos = get_queue(queue);
+    }
+}
+
+/**
+ * Benchmark add_to_set() for cells that are already in the set, as when
+ * the cells around a hit have already been tracked.
+ *
+ * context (void*): the set, holding every 64th of the first 8192 cells
+ * ops (long): the number of cells added
+ *
+ */
+void bench_set_add(void* context, long ops) {
+    CellSet* set = context;
+    volatile bool added;
+    for (long op = 0; op < ops; op++) {
+        added = add_to_set(set, (op % 128) * 64);
+    }
+    (void) added;
+}
+
+/**
+ * Start the agent of a strategy benchmark on a new game.
+ *
+ * strategy (StrategyContext*): the strategy to start
+ *
+ */
+void start_strategy(StrategyContext* strategy) {
+    if (strategy->handle != NULL) {
+        strategy->plugin->free(strategy->handle);
+    }
+    reset_board(strategy->board);
+    strategy->handle = strategy->plugin->init(1, strategy->mapPath, 1);
+    Map map;
+    strategy->plugin->on_rules(strategy->handle, &strategy->board->rules,
+            &map);
+    free_map(&map);
+}
+
+/**
+ * Benchmark a strategy's make_guess(), through its plugin, as player 1
+ * against the board's fleet. Each guess is resolved and its result given
+ * back to the agent, and the game is started again once it is won.
+ *
+ * context (void*): the strategy
+ * ops (long): the number of guesses
+ *
+ */
+void bench_make_guess(void* context, long ops) {
+    StrategyContext* strategy = context;
+    BoardContext* board = strategy->board;
+    for (long op = 0; op < ops; op++) {
+        if (all_ships_sunk(board->map) ||
+                count_unguessed(board->hitmap) == 0) {
+            start_strategy(strategy);
+        }
+        Position pos = strategy->plugin->next_guess(strategy->handle);
+        HitType hit = mark_ship_hit(&board->hitmap, &board->map, pos);
+        strategy->plugin->on_result(strategy->handle, 1, pos,
+                hit == HIT_REHIT ? HIT_MISS : hit);
+    }
+}
+
+/**
+ * Write the board's fleet to a temporary map file for agents to read.
+ *
+ * board (BoardContext*): the board
+ *
+ * Returns the path of the file, to be unlinked and freed.
+ *
+ */
+char* write_map_file(BoardContext* board) {
+    char* path = strdup("/tmp/2310bench-XXXXXX");
+    FILE* file = fdopen(mkstemp(path), "w");
+    for (int i = 0; i < board->map.numShips; i++) {
+        char text[MAX_POSITION_LENGTH];
+        fprintf(file, "%s %c\n", format_position(board->map.ships[i].pos,
+                text), board->map.ships[i].dir);
+    }
+    fclose(file);
+    return path;
+}
+
+/**
+ * Benchmark each strategy on a board, loading them from the plugins
+ * built next to the benchmarks.
+ *
+ * board (BoardContext*): the board
+ * params (char*): the parameters to report
+ * baseline (Baseline*): the results of an earlier run
+ *
+ */
+void bench_strategies(BoardContext* board, char* params,
+        Baseline* baseline) {
+    char* names[] = {"make_guess_A", "make_guess_B", "make_guess_C"};
+    char* paths[] = {"./libagentA.so", "./libagentB.so", "./libagentC.so"};
+    for (int i = 0; i < 3; i++) {
+        void* library = dlopen(paths[i], RTLD_NOW | RTLD_LOCAL);
+        const AgentPlugin* plugin = library == NULL ? NULL :
+                dlsym(library, AGENT_PLUGIN_SYMBOL);
+        if (plugin == NULL || plugin->version != AGENT_PLUGIN_VERSION) {
+            fprintf(stderr, "Skipping %s: cannot load %s\n", names[i],
+                    paths[i]);
+            if (library != NULL) {
+                dlclose(library);
+            }
+            continue;
+        }
+        StrategyContext strategy = {plugin, NULL, write_map_file(board),
+                board};
+        start_strategy(&strategy);
+        run_benchmark(names[i], params, bench_make_guess, &strategy,
+                baseline);
+        plugin->free(strategy.handle);
+        unlink(strategy.mapPath);
+        free(strategy.mapPath);
+        dlclose(library);
+    }
+}
+
+/**
+ * Run the benchmarks that depend on the board and fleet.
+ *
+ * rows (int): the number of rows of the board
+ * cols (int): the number of columns of the board
+ * numShips (int): the number of ships in the fleet
+ * baseline (Baseline*): the results of an earlier run
+ *
+ */
+void bench_board(int rows, int cols, int numShips, Baseline* baseline) {
+    BoardContext board;
+    if (!init_board(&board, rows, cols, numShips)) {
+        return; // the fleet does not fit
+    }
+    char params[64];
+    snprintf(params, sizeof(params), "%dx%d/%d", cols, rows, numShips);
+
+    run_benchmark("mark_ship_hit", params, bench_mark_ship_hit, &board,
+            baseline);
+
+    GameInfo info;
+    memset(&info, 0, sizeof(GameInfo));
+    info.rules = board.rules;
+    info.agents[0].map = copy_map(board.map);
+    info.agents[1].map = copy_map(board.map);
+    run_benchmark("validate_info", params, bench_validate_info, &info,
+            baseline);
+    free_map(&info.agents[0].map);
+    free_map(&info.agents[1].map);
+
+    bench_strategies(&board, params, baseline);
+    free_board(&board);
+}
+
+/**
+ * Run the benchmarks that depend only on the size of the board.
+ *
+ * rows (int): the number of rows of the board
+ * cols (int): the number of columns of the board
+ * baseline (Baseline*): the results of an earlier run
+ *
+ */
+void bench_board_size(int rows, int cols, Baseline* baseline) {
+    BoardContext board;
+    init_board(&board, rows, cols, 1);
+    char params[64];
+    snprintf(params, sizeof(params), "%dx%d", cols, rows);
+
+    // Print a board that is partly shot at
+    mark_ships(&board.hitmap, board.map);
+    bench_mark_ship_hit(&board, rows * cols / 4);
+    run_benchmark("print_hitmap", params, bench_print_hitmap, &board,
+            baseline);
+    free_board(&board);
+}
+
+/**
+ * Run the benchmarks that do not depend on the board.
+ *
+ * baseline (Baseline*): the results of an earlier run
+ *
+ */
+void bench_fixed(Baseline* baseline) {
+    char* text = malloc(1000 * 16 + 1);
+    text[0] = '\0';
+    for (int i = 0; i < 1000; i++) {
+        strcat(text, "GUESS A1,B2,C3\n");
+    }
+    run_benchmark("read_line", "15", bench_read_line, text, baseline);
+    free(text);
+
+    BoardContext board;
+    init_board(&board, 8, 8, 3);
+    run_benchmark("all_ships_sunk", "8x8/3", bench_all_ships_sunk, &board,
+            baseline);
+    free_board(&board);
+
+    Queue queue;
+    init_queue(&queue, 1);
+    run_benchmark("queue_add_get", "1", bench_queue_add_get, &queue,
+            baseline);
+    free_queue(&queue);
+    for (int size = 100; size <= 2000; size *= 20) {
+        char params[32];
+        snprintf(params, sizeof(params), "%dx%d", size, size);
+        CellSet set;
+        init_cell_set(&set, size * size, size * size > SPARSE_MAP_CELLS);
+        for (int cell = 0; cell < 128 * 64; cell += 64) {
+            add_to_set(&set, cell);
+        }
+        run_benchmark("set_add", params, bench_set_add, &set, baseline);
+        free_cell_set(&set);
+    }
+}
+
+int main(int argc, char** argv) {
+    struct option longOptions[] = {
+        {"baseline", required_argument, NULL, 'b'},
+        {NULL, 0, NULL, 0}
+    };
+    Baseline baseline = {NULL, 0, 0};
+    int option;
+    opterr = 0; // usage errors are reported by bench_exit
+    while ((option = getopt_long(argc, argv, "+", longOptions, NULL))
+            != -1) {
+        if (option != 'b') {
+            bench_exit(BENCH_USAGE);
+        }
+        if (!read_baseline(optarg, &baseline)) {
+            bench_exit(BENCH_BAD_BASELINE);
+        }
+    }
+    if (optind != argc) {
+        bench_exit(BENCH_USAGE);
+    }
+
+    printf("# benchmark\tparams\tns_per_op\tstddev\tsamples");
+    printf(baseline.entries != NULL ? "\tbaseline\tchange\n" : "\n");
+    bench_fixed(&baseline);
+
+    int sizes[][2] = {{8, 8}, {100, 100}, {1000, 1000}, {2000, 2000}};
+    int fleets[] = {3, 30, 300};
+    for (int size = 0; size < 4; size++) {
+        bench_board_size(sizes[size][0], sizes[size][1], &baseline);
+        for (int fleet = 0; fleet < 3; fleet++) {
+            bench_board(sizes[size][0], sizes[size][1], fleets[fleet],
+                    &baseline);
+        }
+    }
+
+    for (int i = 0; i < baseline.numEntries; i++) {
+        free(baseline.entries[i].name);
+    }
+    free(baseline.entries);
+    bench_exit(baseline.regressions ? BENCH_REGRESSION : BENCH_NORMAL);
+}
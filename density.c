@@ -0,0 +1,731 @@
+#include "density.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* The steps taken to follow a line of cells left, right, up and down */
+static const int rowSteps[4] = {0, 0, -1, 1};
+static const int colSteps[4] = {-1, 1, 0, 0};
+
+/**
+ * The cells counted while choosing a target.
+ * - cells: each cell counted
+ * - counts: the placements over hits counted on each cell
+ * - numCells: the number of cells counted
+ * - slots: one more than the index in cells of each cell counted, which
+ *   may be left over from an earlier target
+ */
+typedef struct Targets {
+    int* cells;
+    int* counts;
+    int numCells;
+    CellTable* slots;
+} Targets;
+
+/**
+ * Checks if no ship afloat can cover a cell.
+ *
+ * map (DensityMap*): the density map
+ * cell (int): the cell, counting row by row
+ *
+ * Returns true if the cell is a miss or part of a sunk ship.
+ *
+ */
+bool is_blocked(DensityMap* map, int cell) {
+    if (map->sparse) {
+        return get_cell_value(&map->blockedCells, cell) != 0;
+    }
+    return (map->blocked[cell / 64] >> (cell % 64)) & 1;
+}
+
+/**
+ * Finds the first blocked cell in a range, a word at a time.
+ *
+ * map (DensityMap*): the density map, which must not be sparse
+ * from (int): the first cell of the range
+ * end (int): the cell just past the range
+ *
+ * Returns the cell found, or end if there is none.
+ *
+ */
+int next_blocked(DensityMap* map, int from, int end) {
+    int word = from / 64;
+    uint64_t bits = map->blocked[word] & (~0ULL << (from % 64));
+    while (bits == 0) {
+        if (++word * 64 >= end) {
+            return end;
+        }
+        bits = map->blocked[word];
+    }
+    int cell = word * 64 + __builtin_ctzll(bits);
+    return cell < end ? cell : end;
+}
+
+/**
+ * Gets the number of placements of a ship along a line that cover a cell.
+ *
+ * before (int): the free cells from the cell back along the line,
+ *   counting itself
+ * after (int): the free cells from the cell on along the line, counting
+ *   itself
+ * length (int): the length of the ship
+ *
+ * Returns the number of placements.
+ *
+ */
+int line_placements(int before, int after, int length) {
+    int count = before < after ? before : after;
+    if (length < count) {
+        count = length;
+    }
+    if (before + after - length < count) {
+        count = before + after - length;
+    }
+    return count > 0 ? count : 0;
+}
+
+/**
+ * Gets the density of a cell from the free runs around it: the number of
+ * placements of each ship length afloat that cover it.
+ *
+ * map (DensityMap*): the density map
+ * left (int): the free cells from the cell to the left, counting itself
+ * right (int): the free cells from the cell to the right, counting itself
+ * up (int): the free cells from the cell upwards, counting itself
+ * down (int): the free cells from the cell downwards, counting itself
+ *
+ * Returns the density.
+ *
+ */
+int run_density(DensityMap* map, int left, int right, int up, int down) {
+    int density = 0;
+    for (int i = 0; i < map->numLengths; i++) {
+        if (map->afloat[i] > 0) {
+            density += line_placements(left, right, map->lengths[i]) +
+                    line_placements(up, down, map->lengths[i]);
+        }
+    }
+    return density;
+}
+
+/**
+ * Follows the free cells from a cell in one direction, stopping at the
+ * longest ship length afloat.
+ *
+ * map (DensityMap*): the density map
+ * cell (int): the cell to start from
+ * direction (int): the index of the direction in rowSteps and colSteps
+ *
+ * Returns the number of free cells, counting the cell itself.
+ *
+ */
+int free_run(DensityMap* map, int cell, int direction) {
+    int row = cell / map->cols;
+    int col = cell % map->cols;
+    int run = 0;
+    while (run < map->maxLength && row >= 0 && row < map->rows && col >= 0 &&
+            col < map->cols && !is_blocked(map, row * map->cols + col)) {
+        run++;
+        row += rowSteps[direction];
+        col += colSteps[direction];
+    }
+    return run;
+}
+
+/**
+ * Sets the leaf of a cell in the tree of densities and updates the largest
+ * density above it.
+ *
+ * map (DensityMap*): the density map, which must not be sparse
+ * cell (int): the cell
+ * value (int): the density, or -1 if the cell has been shot at
+ *
+ */
+void set_leaf(DensityMap* map, int cell, int value) {
+    int* tree = map->tree;
+    int node = map->leaves + cell;
+    tree[node] = value;
+    for (node /= 2; node > 0; node /= 2) {
+        int largest = tree[2 * node] > tree[2 * node + 1] ? tree[2 * node] :
+                tree[2 * node + 1];
+        if (tree[node] == largest) {
+            break; // nothing above changes either
+        }
+        tree[node] = largest;
+    }
+}
+
+/**
+ * Count the density of a cell again, unless it has been shot at.
+ *
+ * map (DensityMap*): the density map, which must not be sparse
+ * cell (int): the cell
+ *
+ */
+void update_density(DensityMap* map, int cell) {
+    if (map->tree[map->leaves + cell] < 0) {
+        return;
+    }
+    set_leaf(map, cell, is_blocked(map, cell) ? 0 : run_density(map,
+            free_run(map, cell, 0), free_run(map, cell, 1),
+            free_run(map, cell, 2), free_run(map, cell, 3)));
+}
+
+/**
+ * Count the density of every cell again, after the ship lengths afloat
+ * have changed. Each row is split into runs between its blocked cells a
+ * word at a time, and the runs up and down each column are carried from
+ * row to row.
+ *
+ * map (DensityMap*): the density map, which must not be sparse
+ *
+ */
+void recount_density(DensityMap* map) {
+    int cols = map->cols;
+    int cells = map->rows * cols;
+    int cap = map->maxLength;
+    int* down = malloc(sizeof(int) * cells);
+    for (int cell = cells - 1; cell >= 0; cell--) {
+        int below = cell + cols < cells ? down[cell + cols] : 0;
+        down[cell] = is_blocked(map, cell) ? 0 :
+                (below < cap ? below + 1 : cap);
+    }
+    int* up = calloc(cols, sizeof(int));
+    int* leaves = map->tree + map->leaves;
+    for (int start = 0; start < cells; start += cols) {
+        int end = start + cols;
+        for (int from = start; from < end; ) {
+            int stop = next_blocked(map, from, end);
+            for (int cell = from; cell < stop; cell++) {
+                int col = cell - start;
+                up[col] = up[col] < cap ? up[col] + 1 : cap;
+                if (leaves[cell] >= 0) {
+                    int left = cell - from + 1;
+                    int right = stop - cell;
+                    leaves[cell] = run_density(map, left < cap ? left : cap,
+                            right < cap ? right : cap, up[col], down[cell]);
+                }
+            }
+            if (stop < end) {
+                up[stop - start] = 0;
+                if (leaves[stop] >= 0) {
+                    leaves[stop] = 0;
+                }
+            }
+            from = stop + 1;
+        }
+    }
+    for (int node = map->leaves - 1; node > 0; node--) {
+        map->tree[node] = map->tree[2 * node] > map->tree[2 * node + 1] ?
+                map->tree[2 * node] : map->tree[2 * node + 1];
+    }
+    free(up);
+    free(down);
+}
+
+/**
+ * Create a density map for a game with nothing yet shot at.
+ *
+ * rules (Rules): the rules of the game
+ *
+ * Returns the density map, to be freed with free_density_map().
+ *
+ */
+DensityMap* new_density_map(Rules rules) {
+    DensityMap* map = malloc(sizeof(DensityMap));
+    map->rows = rules.numRows;
+    map->cols = rules.numCols;
+    map->sparse = is_sparse_board(rules.numRows, rules.numCols);
+    map->blockedCells = empty_cell_table();
+    map->numHits = 0;
+    map->liveHits = 0;
+    map->hitSlots = empty_cell_table();
+    map->targetSlots = empty_cell_table();
+
+    // Each distinct length, longest first
+    map->lengths = malloc(sizeof(int) * (rules.numShips + 1));
+    map->afloat = malloc(sizeof(int) * (rules.numShips + 1));
+    map->numLengths = 0;
+    for (int ship = 0; ship < rules.numShips; ship++) {
+        int length = rules.shipLengths[ship];
+        int i = 0;
+        while (i < map->numLengths && map->lengths[i] > length) {
+            i++;
+        }
+        if (i < map->numLengths && map->lengths[i] == length) {
+            map->afloat[i]++;
+            continue;
+        }
+        memmove(&map->lengths[i + 1], &map->lengths[i],
+                sizeof(int) * (map->numLengths - i));
+        memmove(&map->afloat[i + 1], &map->afloat[i],
+                sizeof(int) * (map->numLengths - i));
+        map->lengths[i] = length;
+        map->afloat[i] = 1;
+        map->numLengths++;
+    }
+    map->maxLength = map->numLengths ? map->lengths[0] : 0;
+
+    // Room for the hits on the longest ship, and the targets around one hit
+    map->hitCapacity = map->maxLength > 0 ? map->maxLength : 1;
+    map->hits = malloc(sizeof(int) * map->hitCapacity);
+    map->targetCapacity = 4 * (map->maxLength + 1);
+    map->targetCells = malloc(sizeof(int) * map->targetCapacity);
+    map->targetCounts = malloc(sizeof(int) * map->targetCapacity);
+
+    map->blocked = NULL;
+    map->tree = NULL;
+    map->leaves = 0;
+    if (map->sparse) {
+        return map;
+    }
+    int cells = rules.numRows * rules.numCols;
+    map->blocked = calloc((cells + 63) / 64, sizeof(uint64_t));
+    for (map->leaves = 1; map->leaves < cells; map->leaves *= 2) {
+    }
+    map->tree = malloc(sizeof(int) * 2 * map->leaves);
+    for (int node = 0; node < 2 * map->leaves; node++) {
+        map->tree[node] = node - map->leaves < cells ? 0 : -1;
+    }
+    recount_density(map);
+    return map;
+}
+
+/**
+ * Free a density map.
+ *
+ * map (DensityMap*): the density map to be freed
+ *
+ */
+void free_density_map(DensityMap* map) {
+    free(map->lengths);
+    free(map->afloat);
+    free(map->blocked);
+    free_cell_table(&map->blockedCells);
+    free(map->tree);
+    free(map->hits);
+    free_cell_table(&map->hitSlots);
+    free(map->targetCells);
+    free(map->targetCounts);
+    free_cell_table(&map->targetSlots);
+    free(map);
+}
+
+/**
+ * Take a cell we are shooting at out of the cells to choose from.
+ *
+ * map (DensityMap*): the density map
+ * cell (int): the cell
+ *
+ */
+void claim_cell(DensityMap* map, int cell) {
+    if (!map->sparse) {
+        set_leaf(map, cell, -1);
+    }
+}
+
+/**
+ * Block a cell, counting again the cells along its row and column whose
+ * runs it cuts short.
+ *
+ * map (DensityMap*): the density map
+ * cell (int): the cell to block
+ *
+ */
+void block_cell(DensityMap* map, int cell) {
+    if (is_blocked(map, cell)) {
+        return;
+    }
+    if (map->sparse) {
+        set_cell_value(&map->blockedCells, cell, 1);
+        return;
+    }
+    map->blocked[cell / 64] |= 1ULL << (cell % 64);
+    update_density(map, cell);
+    int row = cell / map->cols;
+    int col = cell % map->cols;
+    for (int direction = 0; direction < 4; direction++) {
+        int nextRow = row;
+        int nextCol = col;
+        for (int step = 1; step < map->maxLength; step++) {
+            nextRow += rowSteps[direction];
+            nextCol += colSteps[direction];
+            if (nextRow < 0 || nextRow >= map->rows || nextCol < 0 ||
+                    nextCol >= map->cols) {
+                break;
+            }
+            update_density(map, nextRow * map->cols + nextCol);
+        }
+    }
+}
+
+/**
+ * Finds a cell among the hits not yet known to be part of a sunk ship.
+ *
+ * map (DensityMap*): the density map
+ * cell (int): the cell
+ *
+ * Returns its index in hits, or -1 if it is not there.
+ *
+ */
+int find_hit(DensityMap* map, int cell) {
+    return get_cell_value(&map->hitSlots, cell) - 1;
+}
+
+/**
+ * Put a cell at an index of the hits, noting where it is.
+ *
+ * map (DensityMap*): the density map
+ * hit (int): the index in hits
+ * cell (int): the cell
+ *
+ */
+void place_hit(DensityMap* map, int hit, int cell) {
+    map->hits[hit] = cell;
+    set_cell_value(&map->hitSlots, cell, hit + 1);
+}
+
+/**
+ * Move the cell at one index of the hits to another.
+ *
+ * map (DensityMap*): the density map
+ * from (int): the index of the cell
+ * to (int): the index to move it to
+ *
+ */
+void move_hit(DensityMap* map, int from, int to) {
+    if (from != to) {
+        place_hit(map, to, map->hits[from]);
+    }
+}
+
+/**
+ * Take a cell out of the hits not yet known to be part of a sunk ship.
+ *
+ * map (DensityMap*): the density map
+ * cell (int): the cell, which may not be among the hits
+ *
+ */
+void remove_hit(DensityMap* map, int cell) {
+    int hit = find_hit(map, cell);
+    if (hit < 0) {
+        return;
+    }
+    if (hit < map->liveHits) {
+        // keep the hits worth following up first
+        move_hit(map, --map->liveHits, hit);
+        hit = map->liveHits;
+    }
+    move_hit(map, --map->numHits, hit);
+    set_cell_value(&map->hitSlots, cell, 0);
+}
+
+/**
+ * Work out which cells a sunk ship covered, from the line of hits through
+ * the cell that sank it, and block them. The longest ship afloat that fits
+ * along a line of hits from the cell is taken to be the one sunk; if none
+ * fits, the shortest is taken to have been sunk at the cell alone.
+ *
+ * map (DensityMap*): the density map
+ * cell (int): the cell that sank the ship, already among the hits
+ *
+ */
+void sink_ship(DensityMap* map, int cell) {
+    int runs[4];
+    for (int direction = 0; direction < 4; direction++) {
+        int row = cell / map->cols;
+        int col = cell % map->cols;
+        runs[direction] = 0;
+        while (runs[direction] < map->maxLength && row >= 0 &&
+                row < map->rows && col >= 0 && col < map->cols &&
+                find_hit(map, row * map->cols + col) >= 0) {
+            runs[direction]++;
+            row += rowSteps[direction];
+            col += colSteps[direction];
+        }
+    }
+    int sunk = -1;
+    int along = 0;
+    for (int i = 0; i < map->numLengths && sunk < 0; i++) {
+        for (int direction = 0; direction < 4 && map->afloat[i] > 0;
+                direction++) {
+            if (runs[direction] >= map->lengths[i]) {
+                sunk = i;
+                along = direction;
+                break;
+            }
+        }
+    }
+    int length = sunk < 0 ? 1 : map->lengths[sunk];
+    if (sunk < 0) {
+        for (int i = 0; i < map->numLengths; i++) {
+            if (map->afloat[i] > 0) {
+                sunk = i;
+            }
+        }
+        if (sunk < 0) {
+            return; // more ships sunk than the rules have
+        }
+    }
+
+    for (int step = 0; step < length; step++) {
+        int covered = cell + step * (rowSteps[along] * map->cols +
+                colSteps[along]);
+        remove_hit(map, covered);
+        block_cell(map, covered);
+    }
+    if (--map->afloat[sunk] > 0) {
+        return;
+    }
+    // A length is gone, so every cell counts one fewer
+    map->maxLength = 0;
+    for (int i = 0; i < map->numLengths && !map->maxLength; i++) {
+        if (map->afloat[i] > 0) {
+            map->maxLength = map->lengths[i];
+        }
+    }
+    if (!map->sparse) {
+        recount_density(map);
+    }
+}
+
+/**
+ * Update a density map with the result of one of our shots.
+ *
+ * map (DensityMap*): the density map
+ * pos (Position): the position shot at
+ * hit (HitType): the result of the shot
+ *
+ */
+void record_density(DensityMap* map, Position pos, HitType hit) {
+    int cell = pos.row * map->cols + pos.col;
+    claim_cell(map, cell);
+    if (hit == HIT_MISS) {
+        block_cell(map, cell);
+        return;
+    }
+    if (find_hit(map, cell) < 0) {
+        if (map->numHits == map->hitCapacity) {
+            map->hitCapacity *= 2;
+            map->hits = realloc(map->hits, sizeof(int) * map->hitCapacity);
+        }
+        move_hit(map, map->liveHits, map->numHits++);
+        place_hit(map, map->liveHits++, cell);
+    }
+    if (hit == HIT_SUNK) {
+        sink_ship(map, cell);
+    }
+}
+
+/**
+ * Finds the cell not yet shot at with the highest density, the first in
+ * reading order if there is a tie.
+ *
+ * map (DensityMap*): the density map
+ *
+ * Returns the cell, or -1 if the board is sparse or no ship afloat fits
+ * anywhere not yet shot at.
+ *
+ */
+int densest_cell(DensityMap* map) {
+    if (map->sparse || map->tree[1] <= 0) {
+        return -1;
+    }
+    int node = 1;
+    while (node < map->leaves) {
+        node = map->tree[2 * node] == map->tree[node] ? 2 * node :
+                2 * node + 1;
+    }
+    return node - map->leaves;
+}
+
+/**
+ * Count a placement over a cell that could be shot at.
+ *
+ * targets (Targets*): the cells counted so far (to be modified)
+ * cell (int): the cell
+ *
+ */
+void add_target(Targets* targets, int cell) {
+    // a slot left over from an earlier target no longer holds the cell
+    int c = get_cell_value(targets->slots, cell) - 1;
+    if (c < 0 || c >= targets->numCells || targets->cells[c] != cell) {
+        c = targets->numCells++;
+        targets->cells[c] = cell;
+        targets->counts[c] = 0;
+        set_cell_value(targets->slots, cell, c + 1);
+    }
+    targets->counts[c]++;
+}
+
+/**
+ * Count the placements of the ships afloat over a hit, on each of their
+ * cells not yet shot at.
+ *
+ * map (DensityMap*): the density map
+ * hitMap (HitMap*): our hit map of the opponent's board
+ * hit (int): the cell hit
+ * targets (Targets*): the cells counted so far (to be modified)
+ *
+ * Returns true if any placement has a cell not yet shot at or with a shot
+ * still to be answered.
+ *
+ */
+bool count_placements(DensityMap* map, HitMap* hitMap, int hit,
+        Targets* targets) {
+    int row = hit / map->cols;
+    int col = hit % map->cols;
+    bool open = false;
+    for (int i = 0; i < map->numLengths; i++) {
+        int length = map->lengths[i];
+        for (int direction = 1; direction < 4 && map->afloat[i] > 0;
+                direction += 2) {
+            int rowStep = rowSteps[direction];
+            int colStep = colSteps[direction];
+            for (int offset = 0; offset < length; offset++) {
+                int firstRow = row - offset * rowStep;
+                int firstCol = col - offset * colStep;
+                if (firstRow < 0 || firstCol < 0 ||
+                        firstRow + (length - 1) * rowStep >= map->rows ||
+                        firstCol + (length - 1) * colStep >= map->cols) {
+                    continue;
+                }
+                bool fits = true;
+                for (int k = 0; k < length && fits; k++) {
+                    fits = !is_blocked(map, (firstRow + k * rowStep) *
+                            map->cols + firstCol + k * colStep);
+                }
+                for (int k = 0; k < length && fits; k++) {
+                    Position pos = {firstRow + k * rowStep,
+                            firstCol + k * colStep};
+                    char info = get_position_info(*hitMap, pos);
+                    if (info == HIT_NONE) {
+                        add_target(targets, pos.row * map->cols + pos.col);
+                    }
+                    open |= info == HIT_NONE || info == HIT_PENDING;
+                }
+            }
+        }
+    }
+    return open;
+}
+
+/**
+ * Count the cells next to a hit that have not been shot at.
+ *
+ * map (DensityMap*): the density map
+ * hitMap (HitMap*): our hit map of the opponent's board
+ * hit (int): the cell hit
+ * targets (Targets*): the cells counted so far (to be modified), or NULL
+ *   to only check the cells
+ *
+ * Returns true if any of the cells has not been shot at or has a shot
+ * still to be answered.
+ *
+ */
+bool count_neighbours(DensityMap* map, HitMap* hitMap, int hit,
+        Targets* targets) {
+    bool open = false;
+    for (int direction = 0; direction < 4; direction++) {
+        Position pos = {hit / map->cols + rowSteps[direction],
+                hit % map->cols + colSteps[direction]};
+        if (pos.row < 0 || pos.row >= map->rows || pos.col < 0 ||
+                pos.col >= map->cols) {
+            continue;
+        }
+        char info = get_position_info(*hitMap, pos);
+        if (info == HIT_NONE && targets != NULL) {
+            add_target(targets, pos.row * map->cols + pos.col);
+        }
+        open |= info == HIT_NONE || info == HIT_PENDING;
+    }
+    return open;
+}
+
+/**
+ * Checks if one cell is a better target than another: it is covered by more
+ * placements over hits, or as many but is denser, or as dense but first in
+ * reading order.
+ *
+ * map (DensityMap*): the density map
+ * cell (int): the cell
+ * count (int): the placements over hits covering the cell
+ * best (int): the best cell so far
+ * bestCount (int): the placements over hits covering the best cell
+ *
+ * Returns true if the cell is better.
+ *
+ */
+bool better_target(DensityMap* map, int cell, int count, int best,
+        int bestCount) {
+    if (count != bestCount) {
+        return count > bestCount;
+    }
+    if (!map->sparse) {
+        int density = map->tree[map->leaves + cell];
+        int bestDensity = map->tree[map->leaves + best];
+        if (density != bestDensity) {
+            return density > bestDensity;
+        }
+    }
+    return cell < best;
+}
+
+/**
+ * Finds the cell to shoot at to finish off the ships that have been hit.
+ * Every placement of a ship afloat over a hit is counted once for each hit
+ * it covers, on each of its cells not yet shot at, and the cell counted
+ * most is chosen (see better_target()). Hits with nothing left to shoot at
+ * around them are no longer followed up.
+ *
+ * map (DensityMap*): the density map
+ * hitMap (HitMap*): our hit map of the opponent's board
+ *
+ * Returns the cell, or -1 if no placement covers a hit.
+ *
+ */
+int target_cell(DensityMap* map, HitMap* hitMap) {
+    if (map->liveHits == 0) {
+        return -1;
+    }
+    // Only cells in line with a hit and within a ship of it are counted
+    int capacity = map->liveHits * 4 * (map->maxLength + 1);
+    if (capacity > map->targetCapacity) {
+        map->targetCapacity = capacity > 2 * map->targetCapacity ? capacity :
+                2 * map->targetCapacity;
+        map->targetCells = realloc(map->targetCells,
+                sizeof(int) * map->targetCapacity);
+        map->targetCounts = realloc(map->targetCounts,
+                sizeof(int) * map->targetCapacity);
+    }
+    Targets targets = {map->targetCells, map->targetCounts, 0,
+            &map->targetSlots};
+    for (int h = 0; h < map->liveHits; h++) {
+        if (!count_placements(map, hitMap, map->hits[h], &targets) &&
+                !count_neighbours(map, hitMap, map->hits[h], NULL)) {
+            // nothing is left to shoot at around this hit, but it may yet
+            // be found to be part of a sunk ship
+            int dead = map->hits[h];
+            move_hit(map, --map->liveHits, h--);
+            place_hit(map, map->liveHits, dead);
+        }
+    }
+
+    // No ship afloat fits over the hits, so a sinking was put down to the
+    // wrong cells: try the cells next to them instead
+    if (targets.numCells == 0) {
+        for (int h = 0; h < map->liveHits; h++) {
+            count_neighbours(map, hitMap, map->hits[h], &targets);
+        }
+    }
+
+    int best = -1;
+    for (int c = 0; c < targets.numCells; c++) {
+        if (best < 0 || better_target(map, targets.cells[c],
+                targets.counts[c], targets.cells[best],
+                targets.counts[best])) {
+            best = c;
+        }
+    }
+    return best < 0 ? -1 : targets.cells[best];
+}
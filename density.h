@@ -0,0 +1,82 @@
+#include "game.h"
+
+#ifndef DENSITY_H
+#define DENSITY_H
+
+/*
+ * A density map counts, for every cell of the opponent's board, the ways the
+ * ships still afloat could be placed over it without covering a miss or a
+ * sunk ship. A cell in a free run of a cells on one side (counting itself)
+ * and b on the other is covered by min(a, b, L, a + b - L) placements of a
+ * ship of length L along that line, so each cell is counted in O(1) from its
+ * runs. Runs longer than the longest ship are cut short, which leaves the
+ * count unchanged, so a miss only changes the cells within a ship length of
+ * it along its row and column.
+ */
+
+/**
+ * What agent C knows of where the opponent's ships can be.
+ * - rows: the number of rows of the board
+ * - cols: the number of columns of the board
+ * - lengths: each distinct ship length of the rules, longest first
+ * - afloat: the number of ships of each length not yet sunk
+ * - numLengths: the number of distinct ship lengths
+ * - maxLength: the longest ship length still afloat
+ * - blocked: the cells no ship afloat can cover (misses and sunk ships),
+ *   bit i % 64 of word i / 64 for cell i, NULL for sparse boards
+ * - blockedCells: for sparse boards, 1 for each blocked cell
+ * - sparse: is blockedCells used instead of blocked and tree
+ * - tree: a tournament tree of the density of each cell, the leaves from
+ *   index leaves on, -1 for cells already shot at; tree[i] is the largest
+ *   of tree[2i] and tree[2i + 1]. NULL for sparse boards
+ * - leaves: the number of leaves of tree, a power of two
+ * - hits: the cells hit that are not yet known to be part of a sunk ship,
+ *   the ones still worth following up first
+ * - numHits: the number of those cells
+ * - liveHits: the number of hits worth following up, those with cells
+ *   around them not yet shot at
+ * - hitCapacity: the number of cells hits has room for
+ * - hitSlots: one more than the index in hits of each cell there
+ * - targetCells: the cells counted while choosing a target, kept between
+ *   guesses so they are not allocated each time
+ * - targetCounts: the placements over hits counted on each of those cells
+ * - targetCapacity: the number of cells targetCells has room for
+ * - targetSlots: one more than the index in targetCells of each cell
+ *   counted, so that counting a cell again does not search for it
+ */
+typedef struct DensityMap {
+    int rows;
+    int cols;
+    int* lengths;
+    int* afloat;
+    int numLengths;
+    int maxLength;
+    uint64_t* blocked;
+    CellTable blockedCells;
+    bool sparse;
+    int* tree;
+    int leaves;
+    int* hits;
+    int numHits;
+    int liveHits;
+    int hitCapacity;
+    CellTable hitSlots;
+    int* targetCells;
+    int* targetCounts;
+    int targetCapacity;
+    CellTable targetSlots;
+} DensityMap;
+
+/* Setup */
+DensityMap* new_density_map(Rules rules);
+void free_density_map(DensityMap* map);
+
+/* Results */
+void claim_cell(DensityMap* map, int cell);
+void record_density(DensityMap* map, Position pos, HitType hit);
+
+/* Choosing a cell */
+int densest_cell(DensityMap* map);
+int target_cell(DensityMap* map, HitMap* hitMap);
+
+#endif
@@ -1,16 +1,20 @@
 #include "game.h"
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <unistd.h>
 
 #define INITIAL_BUFFER_SIZE 10
+#define READ_CHUNK_SIZE 4096
 #define MIN_MAP_DIM 1
-#define MAX_MAP_DIM 26
+#define MAX_MAP_DIM 10000
 #define MIN_ARGC 5
 #define STD_RULES_FILE "standard.rules"
 #define MIN_SHIP_COUNT 1
+#define MAX_SHIP_COUNT UINT16_MAX
 #define MIN_SHIP_SIZE 1
 
 /**
@@ -18,32 +22,403 @@
  *
  * stream (FILE*): the file to read from
  *
- * Returns the line of input read. If EOF is read, returns NULL instead.
+ * Returns the line of input read, which must be freed by the caller. If EOF
+ * is read, returns NULL instead. Only used for files; messages are read
+ * through a LineBuffer.
  *
  */
 char* read_line(FILE* stream) {
-    int bufferSize = INITIAL_BUFFER_SIZE;
-    char* buffer = malloc(sizeof(char) * bufferSize);
-    int numRead = 0;
-    int next;
+    char* line = NULL;
+    size_t size = 0;
+    ssize_t length = getline(&line, &size, stream);
+    if (length < 0) {
+        free(line);
+        return NULL;
+    }
+    if (length > 0 && line[length - 1] == '\n') {
+        line[length - 1] = '\0';
+    }
+    return line;
+}
 
-    while (1) {
-        next = fgetc(stream);
-        if (next == EOF && numRead == 0) {
-            free(buffer);
-            return NULL;
+/**
+ * Creates a new empty line buffer.
+ *
+ * Returns the new line buffer.
+ *
+ */
+LineBuffer empty_line_buffer(void) {
+    LineBuffer buffer = {NULL, 0, 0, 0};
+    return buffer;
+}
+
+/**
+ * Reads whatever input is available on the given file descriptor into the
+ * buffer. Blocks only if the file descriptor is blocking.
+ *
+ * buffer (LineBuffer*): the buffer to append to
+ * fd (int): the file descriptor to read from
+ *
+ * Returns the number of bytes read, 0 on EOF or -1 on error (errno is set,
+ * EAGAIN meaning that nothing was available).
+ *
+ */
+int fill_line_buffer(LineBuffer* buffer, int fd) {
+    if (buffer->start > 0) { // only a partial line (if any) is kept
+        buffer->length -= buffer->start;
+        memmove(buffer->data, buffer->data + buffer->start, buffer->length);
+        buffer->start = 0;
+    }
+    if (buffer->size - buffer->length < READ_CHUNK_SIZE) {
+        buffer->size = buffer->length + READ_CHUNK_SIZE;
+        buffer->data = realloc(buffer->data, sizeof(char) * buffer->size);
+    }
+    int numRead = read(fd, buffer->data + buffer->length, 
+            buffer->size - buffer->length);
+    if (numRead > 0) {
+        buffer->length += numRead;
+    }
+    return numRead;
+}
+
+/**
+ * Takes the first complete line from the buffer.
+ *
+ * buffer (LineBuffer*): the buffer to take the line from
+ *
+ * Returns the line without its newline, or NULL if the buffer does not yet
+ * hold a complete line. The line is a view into the buffer, which may be 
+ * modified in place and stays valid until the buffer is next filled.
+ *
+ */
+char* next_buffered_line(LineBuffer* buffer) {
+    if (buffer->data == NULL || buffer->start == buffer->length) {
+        return NULL; // nothing read since the buffer was last emptied
+    }
+    char* line = buffer->data + buffer->start;
+    char* end = memchr(line, '\n', buffer->length - buffer->start);
+    if (end == NULL) {
+        return NULL;
+    }
+    *end = '\0';
+    buffer->start = end + 1 - buffer->data;
+    return line;
+}
+
+/**
+ * Prints the tag of a message, followed by the game id if there is one.
+ *
+ * stream (FILE*): the stream to print to
+ * tag (char*): the tag of the message
+ * game (int): the id of the game, or NO_GAME
+ *
+ */
+void print_tag(FILE* stream, char* tag, int game) {
+    if (game == NO_GAME) {
+        fprintf(stream, "%s", tag);
+    } else {
+        fprintf(stream, "%s g%d", tag, game);
+    }
+}
+
+/**
+ * Removes the game id (a "g" followed by digits) that follows the tag of a
+ * message, leaving the message as it would be without one.
+ *
+ * line (char*): the message to modify
+ *
+ * Returns the game id, or NO_GAME if the message does not have one.
+ *
+ */
+int take_game_id(char* line) {
+    char* start = strchr(line, ' ');
+    if (start == NULL || start[1] != 'g' || !isdigit(start[2])) {
+        return NO_GAME;
+    }
+    char* end;
+    int game = strtol(start + 2, &end, 10);
+    if (*end != ' ' && *end != '\0') {
+        return NO_GAME;
+    }
+    memmove(start, end, strlen(end) + 1);
+    return game;
+}
+
+/**
+ * Creates a tokenizer over the given message.
+ *
+ * message (char*): the message to split into tokens
+ *
+ * Returns the tokenizer, positioned at the start of the message.
+ *
+ */
+Tokenizer new_tokenizer(char* message) {
+    Tokenizer tokens = {message};
+    return tokens;
+}
+
+/**
+ * Skips any spaces before the next token.
+ *
+ * tokens (Tokenizer*): the tokenizer to advance
+ *
+ */
+void skip_spaces(Tokenizer* tokens) {
+    while (*tokens->next == ' ') {
+        tokens->next++;
+    }
+}
+
+/**
+ * Takes the given word (such as the tag of a message) if it is the next
+ * token. The word must not be followed directly by a letter or digit.
+ *
+ * tokens (Tokenizer*): the tokenizer to take from
+ * word (const char*): the word to take
+ *
+ * Returns true if the word was taken, otherwise false (and nothing is
+ * taken).
+ *
+ */
+bool take_word(Tokenizer* tokens, const char* word) {
+    skip_spaces(tokens);
+    char* next = tokens->next;
+    while (*word != '\0') {
+        if (*next++ != *word++) {
+            return false;
         }
-        if (numRead == bufferSize - 1) {
-            bufferSize *= 2;
-            buffer = realloc(buffer, sizeof(char) * bufferSize);
+    }
+    if (isalnum(*next)) {
+        return false;
+    }
+    tokens->next = next;
+    return true;
+}
+
+/**
+ * Takes the given separator if it is the next token.
+ *
+ * tokens (Tokenizer*): the tokenizer to take from
+ * c (char): the separator to take
+ *
+ * Returns true if the separator was taken, otherwise false.
+ *
+ */
+bool take_char(Tokenizer* tokens, char c) {
+    skip_spaces(tokens);
+    if (*tokens->next != c) {
+        return false;
+    }
+    tokens->next++;
+    return true;
+}
+
+/**
+ * Takes a non-negative decimal integer.
+ *
+ * tokens (Tokenizer*): the tokenizer to take from
+ * value (int*): the integer taken (to be modified)
+ *
+ * Returns true if an integer was taken, otherwise false.
+ *
+ */
+bool take_int(Tokenizer* tokens, int* value) {
+    skip_spaces(tokens);
+    if (!isdigit(*tokens->next)) {
+        return false;
+    }
+    int result = 0;
+    while (isdigit(*tokens->next)) {
+        if (result > (INT_MAX - 9) / 10) {
+            return false; // too large to be a count, id or row
         }
-        if (next == '\n' || next == EOF) {
-            buffer[numRead] = '\0';
-            break;
+        result = result * 10 + (*tokens->next++ - '0');
+    }
+    *value = result;
+    return true;
+}
+
+/**
+ * Takes a position written as a column name directly followed by a row
+ * number, e.g. "B3" or "AA10".
+ *
+ * tokens (Tokenizer*): the tokenizer to take from
+ * pos (Position*): the position taken (to be modified)
+ *
+ * Returns true if a position was taken, otherwise false.
+ *
+ */
+bool take_position(Tokenizer* tokens, Position* pos) {
+    skip_spaces(tokens);
+    char* next = tokens->next;
+    int col = 0;
+    while (isupper(*next)) {
+        if (col > MAX_MAP_DIM) {
+            return false; // no board is this wide
         }
-        buffer[numRead++] = next;
+        col = col * 26 + (*next++ - 'A' + 1);
     }
-    return buffer;
+    if (col == 0 || !isdigit(*next)) {
+        return false;
+    }
+    tokens->next = next;
+    int row;
+    if (!take_int(tokens, &row)) {
+        return false;
+    }
+    *pos = new_position(col, row);
+    return true;
+}
+
+/**
+ * Takes a single letter, such as the direction of a ship.
+ *
+ * tokens (Tokenizer*): the tokenizer to take from
+ * letter (char*): the letter taken (to be modified)
+ *
+ * Returns true if a letter was taken, otherwise false.
+ *
+ */
+bool take_letter(Tokenizer* tokens, char* letter) {
+    skip_spaces(tokens);
+    if (!isalpha(*tokens->next)) {
+        return false;
+    }
+    *letter = *tokens->next++;
+    return true;
+}
+
+/**
+ * Takes the game id (a "g" followed by digits) that may follow the tag of
+ * a message.
+ *
+ * tokens (Tokenizer*): the tokenizer to take from
+ *
+ * Returns the game id, or NO_GAME if the message does not have one.
+ *
+ */
+int take_game(Tokenizer* tokens) {
+    skip_spaces(tokens);
+    Tokenizer rest = {tokens->next + 1};
+    int game;
+    if (*tokens->next != 'g' || !isdigit(*rest.next) || 
+            !take_int(&rest, &game) || 
+            (*rest.next != ' ' && *rest.next != '\0')) {
+        return NO_GAME;
+    }
+    tokens->next = rest.next;
+    return game;
+}
+
+/**
+ * Checks if every token of a message has been taken.
+ *
+ * tokens (Tokenizer*): the tokenizer to check
+ *
+ * Returns true if only spaces are left, otherwise false.
+ *
+ */
+bool at_end(Tokenizer* tokens) {
+    skip_spaces(tokens);
+    return *tokens->next == '\0';
+}
+
+/**
+ * Writes a 32 bit integer in little-endian byte order.
+ *
+ * bytes (unsigned char*): where to write the integer
+ * value (unsigned int): the integer to write
+ *
+ */
+void encode_uint32(unsigned char* bytes, unsigned int value) {
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+/**
+ * Reads a 32 bit integer in little-endian byte order.
+ *
+ * bytes (const unsigned char*): where to read the integer from
+ *
+ * Returns the integer read.
+ *
+ */
+unsigned int decode_uint32(const unsigned char* bytes) {
+    unsigned int value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (unsigned int) bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * Creates a new record of the binary protocol.
+ *
+ * type (WireType): the type of message
+ * player (int): the guessing player or the winner, 0 if neither
+ * game (int): the id of the game, or NO_GAME
+ * pos (Position): the position guessed
+ *
+ * Returns the new record.
+ *
+ */
+WireRecord new_record(WireType type, int player, int game, Position pos) {
+    WireRecord record = {type, player, game, pos};
+    return record;
+}
+
+/**
+ * Writes a record of the binary protocol to the given stream. The stream is
+ * not flushed.
+ *
+ * stream (FILE*): the stream to write to
+ * record (WireRecord): the record to write
+ *
+ */
+void write_record(FILE* stream, WireRecord record) {
+    unsigned char bytes[WIRE_RECORD_SIZE] = {0};
+    bytes[0] = record.type;
+    bytes[1] = record.player;
+    encode_uint32(bytes + 4, record.game);
+    encode_uint32(bytes + 8, record.pos.row);
+    encode_uint32(bytes + 12, record.pos.col);
+    fwrite(bytes, sizeof(unsigned char), WIRE_RECORD_SIZE, stream);
+}
+
+/**
+ * Decodes a record of the binary protocol.
+ *
+ * bytes (const unsigned char*): the WIRE_RECORD_SIZE bytes of the record
+ *
+ * Returns the record.
+ *
+ */
+WireRecord decode_record(const unsigned char* bytes) {
+    Position pos = {(int) decode_uint32(bytes + 8), 
+            (int) decode_uint32(bytes + 12)};
+    return new_record(bytes[0], bytes[1], (int) decode_uint32(bytes + 4), 
+            pos);
+}
+
+/**
+ * Removes the first complete record of the binary protocol from the buffer.
+ *
+ * buffer (LineBuffer*): the buffer to take the record from
+ * record (WireRecord*): the record taken (to be modified)
+ *
+ * Returns true if a record was taken, false if the buffer does not yet hold
+ * a complete record.
+ *
+ */
+bool next_buffered_record(LineBuffer* buffer, WireRecord* record) {
+    if (buffer->data == NULL || 
+            buffer->length - buffer->start < WIRE_RECORD_SIZE) {
+        return false;
+    }
+    *record = decode_record((unsigned char*) buffer->data + buffer->start);
+    buffer->start += WIRE_RECORD_SIZE;
+    return true;
 }
 
 /**
@@ -95,17 +470,57 @@ void strtrim(char* string) {
 /**
  * Creates a new position given a letter-number coordinate combination.
  *
- * col (char): the column index
- * row (int): the row index
+ * col (int): the column number, where column A is 1
+ * row (int): the row number, where the top row is 1
  *
  * Returns a new position with the given column and row index.
  *
  */
-Position new_position(char col, int row) {
-    Position pos = {row - 1, col - 'A'};
+Position new_position(int col, int row) {
+    Position pos = {row - 1, col - 1};
     return pos;
 }
 
+/**
+ * Writes the name of a column in the style of a spreadsheet: A to Z, then
+ * AA to AZ, BA and so on.
+ *
+ * col (int): the column index, where column A is 0
+ * name (char*): where to write the name, at least MAX_POSITION_LENGTH long
+ *
+ * Returns the length of the name.
+ *
+ */
+int column_name(int col, char* name) {
+    char reversed[MAX_POSITION_LENGTH];
+    int length = 0;
+    for (int number = col + 1; number > 0; number = (number - 1) / 26) {
+        reversed[length++] = 'A' + (number - 1) % 26;
+    }
+    for (int i = 0; i < length; i++) {
+        name[i] = reversed[length - 1 - i];
+    }
+    name[length] = '\0';
+    return length;
+}
+
+/**
+ * Writes a position as its column name followed by its row number, e.g.
+ * "B3" or "AA10".
+ *
+ * pos (Position): the position to write
+ * text (char*): where to write the position, at least MAX_POSITION_LENGTH
+ * long
+ *
+ * Returns text.
+ *
+ */
+char* format_position(Position pos, char* text) {
+    int length = column_name(pos.col, text);
+    snprintf(text + length, MAX_POSITION_LENGTH - length, "%d", pos.row + 1);
+    return text;
+}
+
 /**
  * Creates and returns a new ship with the given length, position and 
  * direction.
@@ -118,7 +533,7 @@ Position new_position(char col, int row) {
  *
  */
 Ship new_ship(int length, Position pos, Direction dir) {
-    Ship ship = {length, pos, dir, NULL};
+    Ship ship = {length, pos, dir, NULL, length};
     return ship;
 }
 
@@ -131,12 +546,7 @@ Ship new_ship(int length, Position pos, Direction dir) {
  *
  */
 bool ship_sunk(Ship ship) {
-    for (int i = 0; i < ship.length; i++) {
-        if (!ship.hits[i]) {
-            return false;
-        }
-    }
-    return true;
+    return ship.remaining == 0;
 }
 
 /**
@@ -146,7 +556,7 @@ bool ship_sunk(Ship ship) {
  *
  */
 Map empty_map(void) {
-    Map newMap = {NULL, 0};
+    Map newMap = {NULL, 0, NULL, {NULL, 0, 0}, 0, 0};
     return newMap;
 }
 
@@ -167,21 +577,315 @@ void add_ship(Map* map, Ship ship) {
     map->numShips += 1;
 }
 
+/**
+ * Copies the given map so that it can be played (and freed) separately.
+ *
+ * map (Map): the map to copy
+ *
+ * Returns the copy of the map.
+ *
+ */
+Map copy_map(Map map) {
+    Map copy = empty_map();
+    for (int i = 0; i < map.numShips; i++) {
+        Ship ship = map.ships[i];
+        add_ship(&copy, new_ship(0, ship.pos, ship.dir));
+        copy.ships[i].length = ship.length;
+        copy.ships[i].remaining = ship.remaining;
+        if (ship.hits) {
+            copy.ships[i].hits = malloc(sizeof(int) * ship.length);
+            memcpy(copy.ships[i].hits, ship.hits, sizeof(int) * ship.length);
+        }
+    }
+    return copy;
+}
+
+/**
+ * Builds the occupancy grid of a map, so that the ship covering a cell can
+ * be found without searching the fleet, and counts the ships not yet sunk.
+ * The ships must already have their lengths. Building stops at the first
+ * cell that is out of bounds or already covered by another ship.
+ *
+ * map (Map*): the map to build the grid for
+ * rules (Rules): the rules giving the size of the board
+ *
+ * Returns true if every ship is within bounds and no two ships overlap,
+ * else returns false.
+ *
+ */
+bool build_occupancy(Map* map, Rules rules) {
+    free(map->occupancy);
+    free_cell_table(&map->shipCells);
+    map->occupancy = NULL;
+    if (!is_sparse_board(rules.numRows, rules.numCols)) {
+        map->occupancy = calloc(rules.numRows * rules.numCols, sizeof(int));
+    }
+    map->cols = rules.numCols;
+    map->shipsLeft = 0;
+    for (int i = 0; i < map->numShips; i++) {
+        if (!ship_sunk(map->ships[i])) {
+            map->shipsLeft++;
+        }
+        Position pos = map->ships[i].pos;
+        for (int j = 0; j < map->ships[i].length; j++) {
+            if (!position_in_bounds(rules, pos)) {
+                return false;
+            }
+            int cell = map->cols * pos.row + pos.col;
+            if (map->occupancy) {
+                if (map->occupancy[cell]) {
+                    return false;
+                }
+                map->occupancy[cell] = i + 1;
+            } else {
+                if (get_cell_value(&map->shipCells, cell)) {
+                    return false;
+                }
+                set_cell_value(&map->shipCells, cell, i + 1);
+            }
+            pos = next_position_in_direction(pos, map->ships[i].dir);
+        }
+    }
+    return true;
+}
+
+/**
+ * Checks if a board is large enough to keep its maps sparsely.
+ *
+ * rows (int): the number of rows of the board
+ * cols (int): the number of columns of the board
+ *
+ * Returns true if the board has more than SPARSE_MAP_CELLS cells.
+ *
+ */
+bool is_sparse_board(int rows, int cols) {
+    return (long) rows * cols > SPARSE_MAP_CELLS;
+}
+
+/**
+ * Creates a new cell table with no cells.
+ *
+ * Returns the empty table, which allocates nothing until a cell is added.
+ *
+ */
+CellTable empty_cell_table(void) {
+    CellTable table = {NULL, 0, 0};
+    return table;
+}
+
+/**
+ * Finds the entry of a cell table holding the given cell, or the empty
+ * entry where it would go.
+ *
+ * table (CellTable*): the table to look in, with entries allocated
+ * cell (int): the cell to look for
+ *
+ * Returns the entry.
+ *
+ */
+CellEntry* find_cell_entry(CellTable* table, int cell) {
+    // Fibonacci hashing spreads the cells of a row over the table
+    unsigned int slot = ((unsigned int) cell * 2654435769u) & 
+            (table->size - 1);
+    while (table->entries[slot].cell != cell && 
+            table->entries[slot].cell != -1) {
+        slot = (slot + 1) & (table->size - 1);
+    }
+    return &table->entries[slot];
+}
+
+/**
+ * Gets the value stored for a cell in a cell table.
+ *
+ * table (CellTable*): the table to look in
+ * cell (int): the cell, counting row by row
+ *
+ * Returns the value of the cell, or 0 if it is not in the table.
+ *
+ */
+int get_cell_value(CellTable* table, int cell) {
+    if (table->entries == NULL) {
+        return 0;
+    }
+    CellEntry* entry = find_cell_entry(table, cell);
+    return entry->cell == cell ? entry->value : 0;
+}
+
+/**
+ * Resizes a cell table to the given number of entries, moving the cells
+ * across.
+ *
+ * table (CellTable*): the table to resize
+ * size (int): the new number of entries, a power of two
+ *
+ */
+void resize_cell_table(CellTable* table, int size) {
+    CellTable old = *table;
+    table->entries = malloc(sizeof(CellEntry) * size);
+    table->size = size;
+    for (int i = 0; i < size; i++) {
+        table->entries[i].cell = -1;
+    }
+    for (int i = 0; i < old.size; i++) {
+        if (old.entries[i].cell != -1) {
+            *find_cell_entry(table, old.entries[i].cell) = old.entries[i];
+        }
+    }
+    free(old.entries);
+}
+
+/**
+ * Stores a value for a cell in a cell table, adding the cell if it is not
+ * already there. The table is kept at most half full.
+ *
+ * table (CellTable*): the table to update
+ * cell (int): the cell, counting row by row
+ * value (int): the value to store
+ *
+ */
+void set_cell_value(CellTable* table, int cell, int value) {
+    if (2 * (table->count + 1) > table->size) {
+        resize_cell_table(table, table->size ? 2 * table->size : 16);
+    }
+    CellEntry* entry = find_cell_entry(table, cell);
+    if (entry->cell == -1) {
+        entry->cell = cell;
+        table->count++;
+    }
+    entry->value = value;
+}
+
+/**
+ * Free the memory of a cell table, leaving it empty.
+ *
+ * table (CellTable*): the table to be freed
+ *
+ */
+void free_cell_table(CellTable* table) {
+    free(table->entries);
+    *table = empty_cell_table();
+}
+
 /**
  * Checks if all of the ships in the given map have been sunk.
  *
- * map (Map): the map to be checked
+ * map (Map): the map to be checked, with its occupancy grid built
  *
  * Returns true if they have, else returns false.
  *
  */
 bool all_ships_sunk(Map map) {
-    for (int i = 0; i < map.numShips; i++) {
-        if (!ship_sunk(map.ships[i])) {
-            return false;
+    return map.shipsLeft == 0;
+}
+
+/**
+ * Counts the cells of the given hit map that have not been guessed.
+ *
+ * map (HitMap): the map to be checked
+ *
+ * Returns the number of cells that are neither a hit nor a miss.
+ *
+ */
+int count_unguessed(HitMap map) {
+    return map.rows * map.cols - map.numGuessed;
+}
+
+/**
+ * Gets the word of a hit map holding the given cells that are open: not
+ * guessed, not waiting on the result of a salvo and not covered by a ship.
+ *
+ * map (HitMap): the map to look in
+ * word (int): the index of the word
+ *
+ * Returns the word, with a bit set for each open cell.
+ *
+ */
+uint64_t open_cells(HitMap map, int word) {
+    return ~(map.guessed[word] | map.pending[word] | map.ships[word]);
+}
+
+/**
+ * Checks if a cell of a sparse hit map is open: not in either of its
+ * tables.
+ *
+ * map (HitMap): the sparse map to look in
+ * cell (int): the cell, counting row by row
+ *
+ * Returns true if the cell is open, else returns false.
+ *
+ */
+bool is_open_sparse_cell(HitMap map, int cell) {
+    return get_cell_value(&map.marks, cell) == 0 && 
+            get_cell_value(&map.shipMarks, cell) == 0;
+}
+
+/**
+ * Finds the first open cell (one that get_position_info() reports as
+ * HIT_NONE) at or after the given cell, a word at a time.
+ *
+ * map (HitMap): the map to look in
+ * from (int): the cell to start from, counting row by row
+ *
+ * Returns the cell found, or -1 if there is none.
+ *
+ */
+int next_open_cell(HitMap map, int from) {
+    int numCells = map.rows * map.cols;
+    if (from < 0 || from >= numCells) {
+        return -1;
+    }
+    if (map.sparse) {
+        // Few cells are touched, so the next open one is close by
+        for (int cell = from; cell < numCells; cell++) {
+            if (is_open_sparse_cell(map, cell)) {
+                return cell;
+            }
+        }
+        return -1;
+    }
+    int word = from / 64;
+    uint64_t open = open_cells(map, word) & (~0ULL << (from % 64));
+    while (open == 0) {
+        if (++word == map.words) {
+            return -1;
+        }
+        open = open_cells(map, word);
+    }
+    int cell = word * 64 + __builtin_ctzll(open);
+    return cell < numCells ? cell : -1;
+}
+
+/**
+ * Finds the last open cell (one that get_position_info() reports as
+ * HIT_NONE) at or before the given cell, a word at a time.
+ *
+ * map (HitMap): the map to look in
+ * from (int): the cell to start from, counting row by row
+ *
+ * Returns the cell found, or -1 if there is none.
+ *
+ */
+int prev_open_cell(HitMap map, int from) {
+    if (from < 0 || from >= map.rows * map.cols) {
+        return -1;
+    }
+    if (map.sparse) {
+        for (int cell = from; cell >= 0; cell--) {
+            if (is_open_sparse_cell(map, cell)) {
+                return cell;
+            }
+        }
+        return -1;
+    }
+    int word = from / 64;
+    uint64_t open = open_cells(map, word) & (~0ULL >> (63 - from % 64));
+    while (open == 0) {
+        if (--word < 0) {
+            return -1;
         }
+        open = open_cells(map, word);
     }
-    return true;
+    return word * 64 + 63 - __builtin_clzll(open);
 }
 
 /*
@@ -198,21 +902,21 @@ bool is_valid_direction(char dir) {
 }
 
 /*
- * Checks if the the given character is a valid map column.
+ * Checks if the the given column number is a valid map column.
  *
- * col (char): the character to check
+ * col (int): the column number to check, where column A is 1
  *
  * Returns true if valid, false otherwise.
  *
  */
-bool is_valid_column(char col) {
-    return 'A' <= col && col <= 'Z';
+bool is_valid_column(int col) {
+    return MIN_MAP_DIM <= col && col <= MAX_MAP_DIM;
 }
 
 /*
  * Checks if the given row is valid.
  *
- * row (char): the character to check
+ * row (int): the row number to check
  *
  * Returns true if valid, false otherwise.
  *
@@ -235,7 +939,8 @@ bool check_tag(char* tag, char* line) {
 }
 
 /**
- * Creates a new empty hit map.
+ * Creates a new empty hit map. Boards with more than SPARSE_MAP_CELLS cells
+ * get a sparse map, which allocates nothing until cells are marked.
  *
  * rows (int): the number of rows
  * cols (int): the number of columns
@@ -247,55 +952,207 @@ HitMap empty_hitmap(int rows, int cols) {
     HitMap newMap;
     newMap.rows = rows;
     newMap.cols = cols;
-    newMap.data = malloc(sizeof(char) * (rows * cols));
-    memset(newMap.data, HIT_NONE, sizeof(char) * (rows * cols));
+    newMap.sparse = is_sparse_board(rows, cols);
+    newMap.numGuessed = 0;
+    newMap.marks = empty_cell_table();
+    newMap.shipMarks = empty_cell_table();
+    newMap.shipIds = NULL;
+    if (newMap.sparse) {
+        newMap.words = 0;
+        newMap.guessed = newMap.hits = newMap.pending = newMap.ships = NULL;
+        return newMap;
+    }
+    newMap.words = (rows * cols + 63) / 64;
+
+    // All four planes share one allocation
+    newMap.guessed = calloc(4 * newMap.words, sizeof(uint64_t));
+    newMap.hits = newMap.guessed + newMap.words;
+    newMap.pending = newMap.hits + newMap.words;
+    newMap.ships = newMap.pending + newMap.words;
 
     return newMap;
 }
 
+/**
+ * Checks if the bit of a cell is set in a plane of a hit map.
+ *
+ * plane (uint64_t*): the plane to check
+ * cell (int): the cell, counting row by row
+ *
+ * Returns true if it is set, else returns false.
+ *
+ */
+bool test_cell(uint64_t* plane, int cell) {
+    return (plane[cell / 64] >> (cell % 64)) & 1;
+}
+
+/**
+ * Sets or clears the bit of a cell in a plane of a hit map.
+ *
+ * plane (uint64_t*): the plane to update
+ * cell (int): the cell, counting row by row
+ * value (bool): set the bit if true, else clear it
+ *
+ */
+void set_cell(uint64_t* plane, int cell, bool value) {
+    if (value) {
+        plane[cell / 64] |= 1ULL << (cell % 64);
+    } else {
+        plane[cell / 64] &= ~(1ULL << (cell % 64));
+    }
+}
+
 /**
  * Returns the stored information in the hit map for the given position.
  *
  * map (HitMap): the hit map to get information from
  * pos (Position): position to look at
  *
- * Returns the char at position on hitmap.
+ * Returns the character shown at the position: HIT_HIT, HIT_MISS,
+ * HIT_PENDING, the glyph of the ship there or HIT_NONE.
  *
  */
 char get_position_info(HitMap map, Position pos) {
-    return map.data[map.cols * pos.row + pos.col];
+    int cell = map.cols * pos.row + pos.col;
+    if (map.sparse) {
+        char mark = get_cell_value(&map.marks, cell);
+        int ship = get_cell_value(&map.shipMarks, cell);
+        return mark ? mark : (ship ? ship_glyph(ship - 1) : HIT_NONE);
+    }
+    if (test_cell(map.hits, cell)) {
+        return HIT_HIT;
+    } else if (test_cell(map.guessed, cell)) {
+        return HIT_MISS;
+    } else if (test_cell(map.pending, cell)) {
+        return HIT_PENDING;
+    } else if (test_cell(map.ships, cell)) {
+        return ship_glyph(map.shipIds[cell] - 1);
+    }
+    return HIT_NONE;
 }
 
 /**
- * Outputs the given hitmap to the given stream.
+ * Finds the ship marked at the given position of a hit map.
  *
- * map (HitMap): the map to output
- * stream (FILE*): the location to output
- * hideMisses (bool): hide misses when printing
+ * map (HitMap): the hit map to look in
+ * pos (Position): position to look at
+ *
+ * Returns the index of the ship marked there, or -1 if there is none.
  *
  */
-void print_hitmap(HitMap map, FILE* stream, bool hideMisses) {
-    
-    // Print the column headings
-    fprintf(stream, "   ");
-    for (int i = 0; i < map.cols; i++) {
-        fprintf(stream, "%c", 'A' + i);
+int get_ship_id(HitMap map, Position pos) {
+    int cell = map.cols * pos.row + pos.col;
+    if (map.sparse) {
+        return get_cell_value(&map.shipMarks, cell) - 1;
     }
-    fprintf(stream, "\n");
+    return test_cell(map.ships, cell) ? map.shipIds[cell] - 1 : -1;
+}
+
+/**
+ * Gets the character a ship is shown as when a map is printed. The first 15
+ * ships are shown by their number in hex; later ships reuse those digits.
+ *
+ * ship (int): the index of the ship
+ *
+ * Returns the character to show.
+ *
+ */
+char ship_glyph(int ship) {
+    return "123456789ABCDEF"[ship % 15];
+}
+
+/**
+ * Gets the width of the row labels of a printed hit map.
+ *
+ * map (HitMap): the map to be printed
+ *
+ * Returns the number of characters in each row label, not counting the
+ * space after it.
+ *
+ */
+int row_label_width(HitMap map) {
+    int labelWidth = snprintf(NULL, 0, "%d", map.rows);
+    return labelWidth < 2 ? 2 : labelWidth;
+}
 
-    // For each row, print the row heading, followed by the data
+/**
+ * Renders the given hitmap as the text print_hitmap() outputs: the column
+ * names, stacked over several lines for longer names, then each row under
+ * its number. Every line is the same length, so any cell can later be
+ * rewritten in place (see rendered_cell_offset()).
+ *
+ * map (HitMap): the map to render
+ * hideMisses (bool): hide misses when rendering
+ * size (size_t*): the length of the text (to be modified)
+ *
+ * Returns the text, which is not terminated and must be freed.
+ *
+ */
+char* render_hitmap(HitMap map, bool hideMisses, size_t* size) {
+    int labelWidth = row_label_width(map);
+    char name[MAX_POSITION_LENGTH];
+    int nameLength = column_name(map.cols - 1, name);
+    size_t width = labelWidth + 1 + map.cols + 1;
+    *size = width * (nameLength + map.rows);
+
+    // One more for the terminator snprintf() writes after the last label
+    char* text = malloc(sizeof(char) * (*size + 1));
+    char* line = text;
+    for (int i = 0; i < nameLength; i++) {
+        memset(line, ' ', labelWidth + 1);
+        for (int j = 0; j < map.cols; j++) {
+            int offset = nameLength - column_name(j, name);
+            line[labelWidth + 1 + j] = i < offset ? ' ' : name[i - offset];
+        }
+        line[width - 1] = '\n';
+        line += width;
+    }
     for (int i = 0; i < map.rows; i++) {
-        fprintf(stream, "%2d ", i + 1);
+        snprintf(line, labelWidth + 2, "%*d ", labelWidth, i + 1);
         for (int j = 0; j < map.cols; j++) {
             Position pos = {i, j};
             char info = get_position_info(map, pos);
             if (info == HIT_MISS && hideMisses) {
                 info = HIT_NONE;
             }
-            fprintf(stream, "%c", info);
+            line[labelWidth + 1 + j] = info;
         }
-        fprintf(stream, "\n");
+        line[width - 1] = '\n';
+        line += width;
     }
+    return text;
+}
+
+/**
+ * Finds where a cell of a hit map is in the text made by render_hitmap().
+ *
+ * map (HitMap): the map that was rendered
+ * pos (Position): the position of the cell
+ *
+ * Returns the offset of the cell in the text.
+ *
+ */
+size_t rendered_cell_offset(HitMap map, Position pos) {
+    int labelWidth = row_label_width(map);
+    char name[MAX_POSITION_LENGTH];
+    int nameLength = column_name(map.cols - 1, name);
+    size_t width = labelWidth + 1 + map.cols + 1;
+    return width * (nameLength + pos.row) + labelWidth + 1 + pos.col;
+}
+
+/**
+ * Outputs the given hitmap to the given stream, in a single write.
+ *
+ * map (HitMap): the map to output
+ * stream (FILE*): the location to output
+ * hideMisses (bool): hide misses when printing
+ *
+ */
+void print_hitmap(HitMap map, FILE* stream, bool hideMisses) {
+    size_t size;
+    char* text = render_hitmap(map, hideMisses, &size);
+    fwrite(text, sizeof(char), size, stream);
+    free(text);
 }
 
 /** 
@@ -312,21 +1169,189 @@ void print_maps(HitMap cpuMap, HitMap playerMap, FILE* out) {
     print_hitmap(playerMap, out, false);
 }
 
-/** 
- * Prints the given maps to the hub.
+/**
+ * Get the tag of the message reporting a hit type.
+ *
+ * hit (HitType): the type of hit
+ *
+ * Returns HIT, SUNK or MISS.
+ *
+ */
+char* hit_tag(HitType hit) {
+    if (hit == HIT_HIT) {
+        return "HIT";
+    } else if (hit == HIT_SUNK) {
+        return "SUNK";
+    }
+    return "MISS";
+}
+
+/**
+ * Write the result of a guess to the transcript of the game.
+ *
+ * state (GameState*): the state of this game
+ * hit (HitType): the type of hit
+ * id (int): the id of the hitting agent
+ * pos (Position): the position being hit
+ *
+ */
+void print_result(GameState* state, HitType hit, int id, Position pos) {
+    if (state->output != OUTPUT_FULL && state->output != OUTPUT_DELTA) {
+        return;
+    }
+    char text[MAX_POSITION_LENGTH];
+    fprintf(state->out, "%s%s player %d guessed %s\n", 
+            hit == HIT_SUNK ? "SHIP " : "", hit_tag(hit), id, 
+            format_position(pos, text));
+}
+
+/**
+ * Note the cells of a map that a turn has changed, so that they can be
+ * printed without rendering the whole map again.
+ *
+ * state (GameState*): the state of the round
+ * map (int): the index of the map changed
+ * cells (Position*): the cells changed
+ * numCells (int): the number of cells changed
+ *
+ */
+void note_changes(GameState* state, int map, Position* cells, int numCells) {
+    if (state->output != OUTPUT_FULL && state->output != OUTPUT_DELTA) {
+        return; // the final boards are rendered from scratch
+    }
+    if (state->numChanges[map] + numCells > state->info.rules.salvo) {
+        // more changes than a salvo, so render the map again from scratch
+        free(state->boards[map]);
+        state->boards[map] = NULL;
+        state->numChanges[map] = 0;
+        return;
+    }
+    memcpy(state->changes[map] + state->numChanges[map], cells, 
+            sizeof(Position) * numCells);
+    state->numChanges[map] += numCells;
+}
+
+/**
+ * Bring the text of both maps of a round up to date. The maps are rendered
+ * the first time, and after that only their changed cells are rewritten.
+ *
+ * state (GameState*): the state of the round
+ *
+ */
+void update_boards(GameState* state) {
+    for (int map = 0; map < NUM_AGENTS; map++) {
+        if (state->boards[map] == NULL) {
+            state->boards[map] = render_hitmap(state->maps[map], false, 
+                    &state->boardSizes[map]);
+        } else {
+            for (int i = 0; i < state->numChanges[map]; i++) {
+                Position pos = state->changes[map][i];
+                state->boards[map][rendered_cell_offset(state->maps[map], 
+                        pos)] = get_position_info(state->maps[map], pos);
+            }
+        }
+        state->numChanges[map] = 0;
+    }
+}
+
+/**
+ * Write both maps of a round to its transcript.
+ *
+ * state (GameState*): the state of the round
+ * round (int): the number of the round
+ *
+ */
+void print_boards(GameState* state, int round) {
+    update_boards(state);
+    fprintf(state->out, "**********\n");
+    fprintf(state->out, "ROUND %d\n", round);
+    fwrite(state->boards[0], sizeof(char), state->boardSizes[0], state->out);
+    fprintf(state->out, "===\n");
+    fwrite(state->boards[1], sizeof(char), state->boardSizes[1], state->out);
+    fflush(state->out);
+}
+
+/**
+ * Write the cells of a round's maps that have changed since they were last
+ * printed to its transcript, one per line as the player whose map it is,
+ * the position and what is now shown there, e.g. "2 B3 *".
+ *
+ * state (GameState*): the state of the round
+ * round (int): the number of the round
+ *
+ */
+void print_changes(GameState* state, int round) {
+    fprintf(state->out, "**********\n");
+    fprintf(state->out, "ROUND %d\n", round);
+    for (int map = 0; map < NUM_AGENTS; map++) {
+        for (int i = 0; i < state->numChanges[map]; i++) {
+            char text[MAX_POSITION_LENGTH];
+            Position pos = state->changes[map][i];
+            fprintf(state->out, "%d %s %c\n", map + 1, 
+                    format_position(pos, text), 
+                    get_position_info(state->maps[map], pos));
+        }
+        state->numChanges[map] = 0;
+    }
+    fflush(state->out);
+}
+
+/**
+ * Write the maps of a round to its transcript as a new pair of turns
+ * begins: in full, or as the cells that have changed in delta mode after
+ * the first time.
+ *
+ * state (GameState*): the state of the round
+ * round (int): the number of the round
+ *
+ */
+void print_round_maps(GameState* state, int round) {
+    if (state->output == OUTPUT_FULL || 
+            (state->output == OUTPUT_DELTA && (state->boards[0] == NULL || 
+            state->boards[1] == NULL))) {
+        print_boards(state, round);
+    } else if (state->output == OUTPUT_DELTA) {
+        print_changes(state, round);
+    }
+}
+
+/**
+ * Write the end of a round to its transcript, with its final maps in
+ * summary mode.
+ *
+ * state (GameState*): the state of the round
+ * round (int): the number of the round
+ * winner (int): the id of the winning agent
+ *
+ */
+void print_game_over(GameState* state, int round, int winner) {
+    if (state->output == OUTPUT_SUMMARY) {
+        print_boards(state, round);
+    }
+    if (state->output != OUTPUT_SILENT) {
+        fprintf(state->out, "GAME OVER - player %d wins\n", winner);
+        fflush(state->out);
+    }
+}
+
+/**
+ * Reads the name of an output mode: full, delta, summary or silent.
+ *
+ * name (const char*): the name to read
+ * mode (OutputMode*): the mode named (to be modified)
  *
- * playerOneMap (HitMap): the map for the first player
- * playerTwoMap (HitMap): the map for the second player
- * round (int): the round in the hub
+ * Returns true if the name is valid, else returns false.
  *
  */
-void print_hub_maps(HitMap playerOneMap, HitMap playerTwoMap, int round) {
-    printf("**********\n");
-    printf("ROUND %d\n", round);
-    print_hitmap(playerOneMap, stdout, false);
-    printf("===\n");
-    print_hitmap(playerTwoMap, stdout, false);
-    fflush(stdout);
+bool read_output_mode(const char* name, OutputMode* mode) {
+    const char* names[] = {"full", "delta", "summary", "silent"};
+    for (int i = OUTPUT_FULL; i <= OUTPUT_SILENT; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *mode = i;
+            return true;
+        }
+    }
+    return false;
 }
 
 /**
@@ -354,16 +1379,78 @@ Position next_position_in_direction(Position pos, Direction dir) {
     return newPos;
 }
 
+/**
+ * Updates a cell of a sparse hit map with the given data, in the same way
+ * as update_hitmap() does for the planes of a dense one.
+ *
+ * map (HitMap*): the sparse map to update
+ * cell (int): the cell to update, counting row by row
+ * data (char): the data as given to update_hitmap()
+ *
+ */
+void update_sparse_hitmap(HitMap* map, int cell, char data) {
+    char mark = get_cell_value(&map->marks, cell);
+    bool wasGuessed = mark == HIT_HIT || mark == HIT_MISS;
+    if (data == HIT_HIT || data == HIT_MISS) {
+        map->numGuessed += !wasGuessed;
+        set_cell_value(&map->marks, cell, data);
+    } else if (data == HIT_NONE) {
+        map->numGuessed -= wasGuessed;
+        if (mark) {
+            set_cell_value(&map->marks, cell, 0);
+        }
+    } else if (data == HIT_PENDING) {
+        // A guessed cell still shows its result, as with the planes
+        if (!wasGuessed) {
+            set_cell_value(&map->marks, cell, HIT_PENDING);
+        }
+    }
+}
+
 /**
  * Updates the given position in the hitmap with the given data.
  *
  * map (HitMap*): the map to update
  * pos (Position): the position of the map to be updated
- * data (char): the new char to update with
+ * data (char): HIT_HIT, HIT_MISS, HIT_PENDING or HIT_NONE (forgetting any
+ * guess)
  *
  */
 void update_hitmap(HitMap* map, Position pos, char data) {
-    map->data[map->cols * pos.row + pos.col] = data;
+    int cell = map->cols * pos.row + pos.col;
+    if (map->sparse) {
+        update_sparse_hitmap(map, cell, data);
+        return;
+    }
+    if (data == HIT_HIT || data == HIT_MISS || data == HIT_NONE) {
+        map->numGuessed += (data != HIT_NONE) - test_cell(map->guessed, cell);
+        set_cell(map->guessed, cell, data != HIT_NONE);
+        set_cell(map->hits, cell, data == HIT_HIT);
+        set_cell(map->pending, cell, false);
+    } else if (data == HIT_PENDING) {
+        set_cell(map->pending, cell, true);
+    }
+}
+
+/**
+ * Marks a cell of the hit map as covered by the given ship.
+ *
+ * map (HitMap*): the map to update
+ * pos (Position): the position covered
+ * ship (int): the index of the ship covering it
+ *
+ */
+void mark_ship_cell(HitMap* map, Position pos, int ship) {
+    int cell = map->cols * pos.row + pos.col;
+    if (map->sparse) {
+        set_cell_value(&map->shipMarks, cell, ship + 1);
+        return;
+    }
+    if (map->shipIds == NULL) {
+        map->shipIds = calloc(map->rows * map->cols, sizeof(uint16_t));
+    }
+    set_cell(map->ships, cell, true);
+    map->shipIds[cell] = ship + 1;
 }
 
 /**
@@ -378,9 +1465,7 @@ void mark_ships(HitMap* map, Map playerMap) {
         Ship currShip = playerMap.ships[i];
         Position currPos = currShip.pos;
         for (int j = 0; j < currShip.length; j++) {
-            char str[2];
-            snprintf(str, 2, "%X", i + 1);
-            update_hitmap(map, currPos, str[0]);
+            mark_ship_cell(map, currPos, i);
             currPos = next_position_in_direction(currPos, currShip.dir);
         }
     }
@@ -400,32 +1485,33 @@ bool positions_equal(Position first, Position second) {
 }
 
 /**
- * Checks if the given target position will hit the given ship
- * ship (Ship): ship to be hit
- * pos (Position): position to check
- * index (int*): the index of the ship
+ * Finds the segment of the ship at the given position of a map using its
+ * occupancy grid.
  *
- * Returns true if it will and updates index with the position
- * where the ship will be hit (i.e. 0 is the tip), else returns false. 
+ * map (Map*): the map to look in
+ * pos (Position): the position to look at
+ * index (int*): the segment of the ship at the position, where 0 is the tip
+ * (to be modified)
+ *
+ * Returns the index of the ship at the position, or -1 if there is none.
  *
  */
-bool is_ship_hit(Ship ship, Position pos, int* index) { 
-    Position currPos = ship.pos;
-    for (int i = 0; i < ship.length; i++) {
-        if (positions_equal(pos, currPos)) {
-            *index = i;
-            return true;
-        }
-        currPos = next_position_in_direction(currPos, ship.dir);
+int ship_at(Map* map, Position pos, int* index) {
+    int cell = map->cols * pos.row + pos.col;
+    int ship = (map->occupancy ? map->occupancy[cell] : 
+            get_cell_value(&map->shipCells, cell)) - 1;
+    if (ship >= 0) {
+        Position tip = map->ships[ship].pos;
+        *index = abs(pos.row - tip.row) + abs(pos.col - tip.col);
     }
-    return false;
+    return ship;
 }
 
 /** 
  * Marks a hit for the given map position.
  *
  * hitmap (HitMap*): the hitmap to modify
- * playerMap (Map*): the player's map
+ * playerMap (Map*): the player's map, with its occupancy grid built
  * pos (Position): the position to hit
  *
  * Returns the type of hit that was made (HIT, MISS, REHIT)
@@ -436,24 +1522,23 @@ HitType mark_ship_hit(HitMap* hitmap, Map* playerMap, Position pos) {
     if (info == HIT_HIT || info == HIT_MISS) {
         return HIT_REHIT;
     }
-    for (int i = 0; i < playerMap->numShips; i++) {
-        int index;
-        if (is_ship_hit(playerMap->ships[i], pos, &index)) {
-            if (playerMap->ships[i].hits[index]) {
-                return HIT_REHIT;
-            } else {
-                playerMap->ships[i].hits[index] = 1;
-                update_hitmap(hitmap, pos, HIT_HIT);
+    int index;
+    int ship = ship_at(playerMap, pos, &index);
+    if (ship < 0) {
+        update_hitmap(hitmap, pos, HIT_MISS);
+        return HIT_MISS;
+    }
+    if (playerMap->ships[ship].hits[index]) {
+        return HIT_REHIT;
+    }
+    playerMap->ships[ship].hits[index] = 1;
+    update_hitmap(hitmap, pos, HIT_HIT);
 
-                if (ship_sunk(playerMap->ships[i])) {
-                    return HIT_SUNK;
-                }
-                return HIT_HIT;
-            }
-        }
+    if (--playerMap->ships[ship].remaining == 0) {
+        playerMap->shipsLeft--;
+        return HIT_SUNK;
     }
-    update_hitmap(hitmap, pos, HIT_MISS);
-    return HIT_MISS;
+    return HIT_HIT;
 }
 
 /**
@@ -469,6 +1554,7 @@ void update_ship_length(Ship* ship, int newLength) {
     }
     ship->hits = calloc(newLength, sizeof(int));
     ship->length = newLength;
+    ship->remaining = newLength;
 }
 
 /** 
@@ -527,7 +1613,8 @@ RuleReadState read_num_ships(char* line, Rules* rules) {
     char* err;
     int numShips = strtol(line, &err, 10);
     
-    if (err == line || *err != '\0' || numShips < MIN_SHIP_COUNT) {
+    if (err == line || *err != '\0' || numShips < MIN_SHIP_COUNT ||
+            numShips > MAX_SHIP_COUNT) {
         return READ_INVALID;
     }
     rules->numShips = numShips;
@@ -570,6 +1657,31 @@ RuleReadState read_ship_length(char* line, int* numRead, Rules* rules) {
     return READ_LENGTHS;
 }
 
+/**
+ * Reads the optional salvo line that may follow the ship lengths, of the
+ * form "salvo k". Any other line is ignored.
+ *
+ * line (char*): the line to be read from
+ * rules (Rules*): the rules to be updated
+ *
+ * If the salvo line is invalid, returns READ_INVALID, otherwise returns
+ * READ_DONE.
+ *
+ */
+RuleReadState read_salvo(char* line, Rules* rules) {
+    if (strncmp(line, "salvo", strlen("salvo"))) {
+        return READ_DONE;
+    }
+
+    int salvo;
+    char dummy;
+    if (sscanf(line, "salvo %d%c", &salvo, &dummy) != 1 || salvo < 1) {
+        return READ_INVALID;
+    }
+    rules->salvo = salvo;
+    return READ_DONE;
+}
+
 /**
  * Attempts to read the rules file at the given filepath.
  * Updates the provided rules to contain the read information.
@@ -591,6 +1703,7 @@ HubStatus read_rules_file(char* filepath, Rules* rules) {
     char* next;
     int shipLengthsRead = 0;
     rules->shipLengths = NULL;
+    rules->salvo = 1;
 
     while ((next = read_line(infile)) != NULL) {
         strtrim(next);
@@ -605,8 +1718,7 @@ HubStatus read_rules_file(char* filepath, Rules* rules) {
         } else if (state == READ_LENGTHS) {
             state = read_ship_length(next, &shipLengthsRead, rules);
         } else if (state == READ_DONE) {
-            free(next); 
-            continue;
+            state = read_salvo(next, rules);
         } else if (state == READ_INVALID) {
             free(next);
             break;
@@ -621,6 +1733,21 @@ HubStatus read_rules_file(char* filepath, Rules* rules) {
     return NORMAL;
 }
 
+/**
+ * Copies the given rules so that they can be owned (and freed) separately.
+ *
+ * rules (Rules): the rules to copy
+ *
+ * Returns the copy of the rules.
+ *
+ */
+Rules copy_rules(Rules rules) {
+    Rules copy = rules;
+    copy.shipLengths = malloc(sizeof(int) * rules.numShips);
+    memcpy(copy.shipLengths, rules.shipLengths, sizeof(int) * rules.numShips);
+    return copy;
+}
+
 /**
  * Read to a delimeter (',' or '\0') in the config file.
  *
@@ -670,23 +1797,19 @@ HubStatus read_config_line(char* line, GameInfo* info) {
     while (true) {
         if (count == 0) {
             current = config_read_to(&index, line + index);
-            newInfo.agents[0].programPath = malloc(sizeof(current));
-            strcpy(newInfo.agents[0].programPath, current);
+            newInfo.agents[0].programPath = strdup(current);
             count++;
         } else if (count == 1) {
             current = config_read_to(&index, line + index);
-            newInfo.agents[0].mapPath = malloc(sizeof(current));
-            strcpy(newInfo.agents[0].mapPath, current);
+            newInfo.agents[0].mapPath = strdup(current);
             count++;
         } else if (count == 2) {
             current = config_read_to(&index, line + index);
-            newInfo.agents[1].programPath = malloc(sizeof(current));
-            strcpy(newInfo.agents[1].programPath, current);
+            newInfo.agents[1].programPath = strdup(current);
             count++;
         } else if (count == 3) {
             current = config_read_to(&index, line + index);
-            newInfo.agents[1].mapPath = malloc(sizeof(current));
-            strcpy(newInfo.agents[1].mapPath, current);
+            newInfo.agents[1].mapPath = strdup(current);
             count++;
         } else {
             break;
@@ -749,122 +1872,37 @@ bool position_in_bounds(Rules rules, Position pos) {
     return withinVerticalBounds && withinHorizontalBounds;
 }
 
-/**
- * Checks if the given ship is within bounds with the given set of rules.
- *
- * rules (Rules): the given rules
- * ship (Ship): the ship to check
- *
- * Returns true if it is, else returns false.
- *
- */
-bool ship_within_bounds(Rules rules, Ship ship) {
-    
-    Position currentPos = ship.pos;
-    for (int i = 0; i < ship.length; i++) {
-        if (!position_in_bounds(rules, currentPos)) {
-            return false;
-        }
-        currentPos = next_position_in_direction(currentPos, ship.dir);
-    }
-    return true;
-}
-
-/**
- * Checks if the two given ships overlap.
- *
- * first (Ship): the first ship to check
- * second (Ship): the second ship to check
- *
- * Returns true if they do, else returns false.
- *
- */
-bool ships_overlap(Ship first, Ship second) {
-    
-    Position currPosFirst = first.pos;
-    for (int i = 0; i < first.length; i++) {
-        Position currPosSecond = second.pos;
-        for (int j = 0; j < second.length; j++) {
-            if (positions_equal(currPosFirst, currPosSecond)) {
-                return true;
-            }
-            currPosSecond = next_position_in_direction(currPosSecond, 
-                    second.dir);
-        }
-        currPosFirst = next_position_in_direction(currPosFirst, first.dir);
-    }
-    return false;
-}
-
-/**
- * Checks that information associated with a ship is valid.
- *
- * col (char): an alpha representation of a column
- * row (char): a digit representation of a row
- * dir (char): ship direction
- *
- * Returns true if valid, otherwise false
- *
- */
-bool validate_ship_info(char col, char row, char dir) {
-    if (!isalpha(col) || !isdigit(row) || !isalpha(dir)) {
-        return false;
-    }
-    return true;
-}
-
 /**
  * Checks that the provided game information represents a valid game.
  *
- * info (GameInfo): the info to validate
+ * info (GameInfo*): the info to validate
  *
  * If the game information is invalid, returns the appropriate error
- * code. Otherwise returns NORMAL and merges the game rules into the 
- * player maps.
+ * code. Otherwise returns NORMAL, having merged the game rules into the 
+ * player maps and built their occupancy grids.
  *
  */
-HubStatus validate_info(GameInfo info) {
+HubStatus validate_info(GameInfo* info) {
     
     // Check that enough ships were read
-    if (info.agents[0].map.numShips < info.rules.numShips) {
-        return INVALID_RULES;
-    }
-    if (info.agents[1].map.numShips < info.rules.numShips) {
-        return INVALID_RULES;
+    for (int id = 0; id < NUM_AGENTS; id++) {
+        if (info->agents[id].map.numShips < info->rules.numShips) {
+            return INVALID_RULES;
+        }
     }
 
     // Update the ship lengths using those stated by the rules
-    for (int i = 0; i < info.rules.numShips; i++) {
-        update_ship_length(&info.agents[0].map.ships[i], 
-                info.rules.shipLengths[i]);
-        update_ship_length(&info.agents[1].map.ships[i], 
-                info.rules.shipLengths[i]);
+    for (int i = 0; i < info->rules.numShips; i++) {
+        update_ship_length(&info->agents[0].map.ships[i], 
+                info->rules.shipLengths[i]);
+        update_ship_length(&info->agents[1].map.ships[i], 
+                info->rules.shipLengths[i]);
     }
     
-    // Next, check that the ships do not overlap
-    for (int i = 0; i < info.rules.numShips; i++) {
-        for (int j = i + 1; j < info.rules.numShips; j++) {
-            if (ships_overlap(info.agents[0].map.ships[i], 
-                    info.agents[0].map.ships[j])) {
-                return INVALID_CONFIG;
-            }
-            if (ships_overlap(info.agents[1].map.ships[i], 
-                    info.agents[1].map.ships[j])) {
-                return INVALID_CONFIG;
-            }
-        }
-    }
-
-    // Finally, check that the ships are all within bounds
-    for (int i = 0; i < info.rules.numShips; i++) {
-        if (!ship_within_bounds(info.rules, 
-                info.agents[0].map.ships[i])) {
-            return INVALID_CONFIG;
-        }
-    }
-    for (int i = 0; i < info.rules.numShips; i++) {
-        if (!ship_within_bounds(info.rules, 
-                info.agents[1].map.ships[i])) {
+    // Then place the ships on their grids, which finds any that overlap or
+    // are out of bounds in one pass
+    for (int id = 0; id < NUM_AGENTS; id++) {
+        if (!build_occupancy(&info->agents[id].map, info->rules)) {
             return INVALID_CONFIG;
         }
     }
@@ -874,7 +1912,8 @@ HubStatus validate_info(GameInfo info) {
 /**
  * Initialise a game state with the given game info.
  *
- * info (GameInfo): the game info to use
+ * info (GameInfo): the game info to use, already validated so that the
+ * occupancy grids of its maps are built
  *
  * Returns a new game state with the given info.
  *
@@ -883,6 +1922,20 @@ GameState init_game(GameInfo info) {
     
     GameState newGame;
     newGame.info = info;
+    newGame.turn = 0;
+    newGame.out = stdout;
+    newGame.output = OUTPUT_FULL;
+    newGame.shots = malloc(sizeof(Position) * info.rules.salvo);
+    newGame.numShots = 0;
+    newGame.turnStarted = 0;
+
+    // Each map changes by at most one salvo between printings
+    for (int map = 0; map < NUM_AGENTS; map++) {
+        newGame.boards[map] = NULL;
+        newGame.boardSizes[map] = 0;
+        newGame.changes[map] = malloc(sizeof(Position) * info.rules.salvo);
+        newGame.numChanges[map] = 0;
+    }
     
     // Set up hit maps
     newGame.maps[0] = empty_hitmap(info.rules.numRows, info.rules.numCols);
@@ -908,6 +1961,8 @@ Rounds init_rounds(GameInfo* info, int numRounds) {
     newRounds.rounds = numRounds;
     newRounds.states = malloc(0);
     newRounds.inProgress = malloc(0);
+    newRounds.processes = NULL;
+    newRounds.numProcesses = 0;
 
     for (int round = 0; round < numRounds; round++) {
         GameState current = init_game(info[round]);
@@ -929,10 +1984,12 @@ Rounds init_rounds(GameInfo* info, int numRounds) {
  *
  */
 void free_hitmap(HitMap* map) {   
-    if (map->data) {
-        free(map->data);
-        map->data = NULL;
-    }
+    free(map->guessed);
+    free(map->shipIds);
+    map->guessed = map->hits = map->pending = map->ships = NULL;
+    map->shipIds = NULL;
+    free_cell_table(&map->marks);
+    free_cell_table(&map->shipMarks);
 }
 
 /**
@@ -948,6 +2005,38 @@ void free_rules(Rules* rules) {
     }
 }
 
+/**
+ * Free the memory of a line buffer
+ *
+ * buffer (LineBuffer*): the buffer to be freed
+ *
+ */
+void free_line_buffer(LineBuffer* buffer) {
+    if (buffer->data) {
+        free(buffer->data);
+        buffer->data = NULL;
+    }
+    buffer->start = buffer->length = buffer->size = 0;
+}
+
+/**
+ * Frees all memory associated with the given agent process. The process
+ * itself is freed as well.
+ *
+ * process (AgentProcess*): the process to be freed
+ *
+ */
+void free_process(AgentProcess* process) {
+    if (process->in) {
+        fclose(process->in);
+    }
+    close(process->out);
+    free_line_buffer(&process->buffer);
+    free(process->programPath);
+    free(process->mapPath);
+    free(process);
+}
+
 /**
  * Frees all memory associated with the given ship.
  *
@@ -975,6 +2064,9 @@ void free_map(Map* map) {
         free(map->ships);
         map->ships = NULL;
     }
+    free(map->occupancy);
+    map->occupancy = NULL;
+    free_cell_table(&map->shipCells);
 }
 
 /**
@@ -1011,4 +2103,9 @@ void free_game(GameState* state) {
     free_game_info(&state->info);
     free_hitmap(&state->maps[0]);
     free_hitmap(&state->maps[1]);
+    free(state->shots);
+    for (int map = 0; map < NUM_AGENTS; map++) {
+        free(state->boards[map]);
+        free(state->changes[map]);
+    }
 }
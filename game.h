@@ -1,10 +1,23 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifndef GAME_H
 #define GAME_H
 
 #define NUM_AGENTS 2
+#define NUM_DIRECTIONS 4
+#define NO_GAME -1
+
+/* Room for a written position such as "AA10", with its terminator */
+#define MAX_POSITION_LENGTH 16
+
+/* The size of a record in the binary protocol */
+#define WIRE_RECORD_SIZE 16
+
+/* Boards with more cells than this keep their hit maps and occupancy
+ * sparsely, in tables of the cells touched, instead of one entry per cell */
+#define SPARSE_MAP_CELLS (1 << 20)
 
 /* Exit codes for the hub, as per the specification, from 0 by default. */
 typedef enum {
@@ -23,12 +36,14 @@ typedef enum {
  * - numCols: the number of columns on the board
  * - numShips: the number of ships on the board
  * - shipLengths: the length of each ship on the board
+ * - salvo: the number of shots an agent takes each turn
  */
 typedef struct Rules {
     int numRows;
     int numCols;
     int numShips;
     int* shipLengths;
+    int salvo;
 } Rules;
 
 /**
@@ -54,42 +69,176 @@ typedef enum Direction {
  * - pos: the position of the ship on the board
  * - dir: the direction that the ship is facing
  * - hits: where the current ship has been hit
+ * - remaining: the number of segments not yet hit
  */
 typedef struct Ship {
     int length;
     Position pos;
     Direction dir;
     int* hits;
+    int remaining;
 } Ship;
 
+/**
+ * An entry of a cell table.
+ * - cell: the cell, counting row by row, or -1 if the entry is empty
+ * - value: the value stored for the cell
+ */
+typedef struct CellEntry {
+    int cell;
+    int value;
+} CellEntry;
+
+/**
+ * A hash table from cells to values, using open addressing, for boards too
+ * large to give every cell an entry. Cells not in the table have value 0.
+ * - entries: the entries of the table, NULL until a cell is added
+ * - size: the number of entries, a power of two
+ * - count: the number of entries in use
+ */
+typedef struct CellTable {
+    CellEntry* entries;
+    int size;
+    int count;
+} CellTable;
+
 /**
  * A player map.
  * - ships: The ships on the player's board
  * - numShips: The number of ships on the player's board
+ * - occupancy: for each cell of the board (row by row), one more than the
+ *   index of the ship covering it, or 0 if it is empty; NULL until built,
+ *   and left NULL for sparse boards
+ * - shipCells: the same as occupancy but holding only the cells covered by
+ *   a ship, used instead of occupancy for sparse boards
+ * - cols: the number of columns of the occupancy grid
+ * - shipsLeft: the number of ships not yet sunk, counted when the grid is
+ *   built
  */
 typedef struct Map {
     Ship* ships;
     int numShips;
+    int* occupancy;
+    CellTable shipCells;
+    int cols;
+    int shipsLeft;
 } Map;
 
+/* The types of record in the binary protocol */
+typedef enum WireType {
+    WIRE_YT = 1,
+    WIRE_GUESS,
+    WIRE_OK,
+    WIRE_HIT,
+    WIRE_SUNK,
+    WIRE_MISS,
+    WIRE_DONE,
+    WIRE_SALVO
+} WireType;
+
+/**
+ * A message of the binary protocol, which replaces the YT, GUESS, OK, HIT,
+ * SUNK, MISS, DONE and SALVO lines once agreed on. On the wire it is 
+ * WIRE_RECORD_SIZE bytes: the type, the player, two zero bytes, then the
+ * game id, row and column as little-endian 32 bit integers.
+ * - type: the type of message
+ * - player: the guessing player (HIT, SUNK, MISS, SALVO) or the winner 
+ *   (DONE)
+ * - game: the id of the game, or NO_GAME
+ * - pos: the position guessed (GUESS, HIT, SUNK, MISS); for SALVO the row is
+ *   the number of HIT, SUNK and MISS records that follow
+ */
+typedef struct WireRecord {
+    WireType type;
+    int player;
+    int game;
+    Position pos;
+} WireRecord;
+
+/**
+ * Input read from a file descriptor in large chunks, which is handed out a
+ * line (or record) at a time without copying. Bytes before start have been
+ * handed out already; the rest may end in a partial line.
+ * - data: the bytes read so far
+ * - start: the offset of the first byte not yet handed out
+ * - length: the number of bytes held in data
+ * - size: the allocated size of data
+ */
+typedef struct LineBuffer {
+    char* data;
+    int start;
+    int length;
+    int size;
+} LineBuffer;
+
+/**
+ * A cursor over a message, which is split into tokens in place instead of
+ * with sscanf().
+ * - next: the first character not yet taken
+ */
+typedef struct Tokenizer {
+    char* next;
+} Tokenizer;
+
 /**
- * Represents an agent process.
+ * An agent program started by the hub. An unshared process plays the game of
+ * a single round. A shared process plays a game in every round it is used
+ * in, and every message to and from it carries the id of the game (the
+ * round number).
+ *
+ * - programPath: path to the program the process runs
+ * - mapPath: path to the map given to the program
+ * - id: the player id given to the program
+ * - pid: process id of the agent
+ * - in: pipe in for the agent
+ * - out: file descriptor of the pipe out for the agent
+ * - buffer: input read from out but not yet consumed
+ * - shared: do messages carry game ids
+ * - binary: has the process switched to the binary protocol
+ * - round: the round played by an unshared process
+ * - activeGames: the number of games the process is still playing
+ * - worker: the worker that plays the rounds of this process
+ *
+ */
+typedef struct AgentProcess {
+    char* programPath;
+    char* mapPath;
+    int id;
+    int pid;
+    FILE* in;
+    int out;
+    LineBuffer buffer;
+    bool shared;
+    bool binary;
+    int round;
+    int activeGames;
+    int worker;
+} AgentProcess;
+
+struct AgentPlugin;
+
+/**
+ * Represents an agent (player) in a round.
  *
  * - mapPath: path to the agent's map
  * - programPath: path to the program the agent runs
- * - pid: process id of the agent
  * - map: the map of the agent
- * - in: pipe in for the agent
- * - out: pipe out for the agent
+ * - process: the process playing as this agent, NULL for a plugin
+ * - game: the game id used in messages, NO_GAME if the process is unshared
+ * - plugin: the plugin playing in-process as this agent, NULL for a process
+ * - handle: the plugin's agent
+ * - program: the index of the agent's program in the hub's metrics
  *
  */
 typedef struct Agent {
     char* mapPath;
     char* programPath;
-    int pid;
     Map map;
-    FILE* in;
-    FILE* out;
+    AgentProcess* process;
+    int game;
+    const struct AgentPlugin* plugin;
+    void* handle;
+    int program;
 } Agent;
 
 /**
@@ -106,25 +255,81 @@ typedef struct GameInfo {
 } GameInfo;
 
 /**
- * The hit map for a player.
- * - data: the map of hits (2D represented by 1D array)
+ * The hit map for a player, stored as planes of bits so that it can be
+ * searched and counted 64 cells at a time. Cell i (counting row by row) is
+ * bit i % 64 of word i / 64 of each plane. Sparse boards leave the planes
+ * NULL and keep only the cells touched, in marks and shipMarks.
+ * - guessed: cells that have been guessed, whether hit or missed
+ * - hits: cells that have been hit
+ * - pending: cells shot at in a salvo whose results have not yet arrived
+ * - ships: cells covered by a ship
+ * - shipIds: for each cell, one more than the index of the ship marked
+ *   there (0 for none), NULL until a ship is marked
+ * - marks: for sparse boards, the HIT_HIT, HIT_MISS or HIT_PENDING of each
+ *   cell guessed or shot at
+ * - shipMarks: for sparse boards, the shipIds of the cells with a ship
+ * - sparse: are marks and shipMarks used instead of the planes
+ * - numGuessed: the number of cells that have been guessed
  * - rows: the number of rows for the map
  * - cols: the number of columns for the map
+ * - words: the number of words in each plane
  */
 typedef struct HitMap {
-    char* data;
+    uint64_t* guessed;
+    uint64_t* hits;
+    uint64_t* pending;
+    uint64_t* ships;
+    uint16_t* shipIds;
+    CellTable marks;
+    CellTable shipMarks;
+    bool sparse;
+    int numGuessed;
     int rows;
     int cols;
+    int words;
 } HitMap;
 
+/**
+ * How much of each game the hub writes to its transcript.
+ * - OUTPUT_FULL: both boards before every pair of turns, and every guess
+ * - OUTPUT_DELTA: both boards once, then only the cells that change, and
+ *   every guess
+ * - OUTPUT_SUMMARY: the final boards and the winner
+ * - OUTPUT_SILENT: nothing
+ */
+typedef enum OutputMode {
+    OUTPUT_FULL, OUTPUT_DELTA, OUTPUT_SUMMARY, OUTPUT_SILENT
+} OutputMode;
+
 /**
  * The overall state of a game.
  * - info: the information for the current game
  * - maps[]: the hit maps for the players
+ * - turn: the index of the agent that has been sent YT and owes a GUESS
+ * - out: where the transcript of the game is written
+ * - output: how much of the game is written to out
+ * - shots: the shots of the salvo being taken
+ * - numShots: the number of shots received so far
+ * - boards[]: the text of each map as last printed, NULL until printed
+ * - boardSizes[]: the length of the text of each map
+ * - changes[]: the cells of each map changed since it was last printed
+ * - numChanges[]: the number of changed cells of each map
+ * - turnStarted: when the agent whose turn it is was prompted, in
+ *   nanoseconds
  */
 typedef struct GameState {
     GameInfo info;
     HitMap maps[2];
+    int turn;
+    FILE* out;
+    OutputMode output;
+    Position* shots;
+    int numShots;
+    char* boards[2];
+    size_t boardSizes[2];
+    Position* changes[2];
+    int numChanges[2];
+    long turnStarted;
 } GameState;
 
 /**
@@ -132,11 +337,15 @@ typedef struct GameState {
  * - states: the states of each round
  * - round: the number of rounds
  * - inProgress: rounds in progress
+ * - processes: the agent processes playing the rounds
+ * - numProcesses: the number of agent processes
  */
 typedef struct Rounds {
     GameState* states;
     int rounds;
     bool* inProgress;
+    AgentProcess** processes;
+    int numProcesses;
 } Rounds;
 
 /* Current state of reading in the play loop */
@@ -155,7 +364,8 @@ typedef enum HitType {
     HIT_MISS = '/',
     HIT_HIT = '*',
     HIT_REHIT,
-    HIT_SUNK
+    HIT_SUNK,
+    HIT_PENDING = '?'
 } HitType;
 
 /* Current state of reading in the play loop */
@@ -167,29 +377,56 @@ typedef enum PlayReadState {
 HubStatus read_rules_file(char* filepath, Rules* rules);
 GameInfo* read_config_file(char* filepath, HubStatus* status, int* rounds);
 
-HubStatus validate_info(GameInfo info);
+HubStatus validate_info(GameInfo* info);
 GameState init_game(GameInfo info);
 Rounds init_rounds(GameInfo* info, int numRounds);
 
 /* Memory management */
 void free_game(GameState* state);
+void free_game_info(GameInfo* info);
 void free_map(Map* map);
 void free_rules(Rules* rules);
 void free_hitmap(HitMap* map);
+void free_line_buffer(LineBuffer* buffer);
+void free_process(AgentProcess* process);
 
 /* Util */
-Position new_position(char col, int row);
+Position new_position(int col, int row);
+int column_name(int col, char* name);
+char* format_position(Position pos, char* text);
 char* read_line(FILE* stream);
+LineBuffer empty_line_buffer(void);
+int fill_line_buffer(LineBuffer* buffer, int fd);
+char* next_buffered_line(LineBuffer* buffer);
+Rules copy_rules(Rules rules);
+Map copy_map(Map map);
+void print_tag(FILE* stream, char* tag, int game);
+int take_game_id(char* line);
+
+/* Tokenizer */
+Tokenizer new_tokenizer(char* message);
+bool take_word(Tokenizer* tokens, const char* word);
+bool take_char(Tokenizer* tokens, char c);
+bool take_int(Tokenizer* tokens, int* value);
+bool take_position(Tokenizer* tokens, Position* pos);
+bool take_letter(Tokenizer* tokens, char* letter);
+int take_game(Tokenizer* tokens);
+bool at_end(Tokenizer* tokens);
+
+/* Binary protocol */
+WireRecord new_record(WireType type, int player, int game, Position pos);
+void write_record(FILE* stream, WireRecord record);
+bool next_buffered_record(LineBuffer* buffer, WireRecord* record);
 bool check_tag(char* tag, char* line);
 void strtrim(char* string);
-bool validate_ship_info(char col, char row, char dir);
 bool is_comment(char* line);
 
 bool is_valid_direction(char dir);
-bool is_valid_column(char col);
+bool is_valid_column(int col);
 bool is_valid_row(int row);
 
 bool positions_equal(Position first, Position second);
+bool position_in_bounds(Rules rules, Position pos);
 
 /* Hit maps */
 void update_hitmap(HitMap* map, Position pos, char data);
@@ -198,14 +435,34 @@ HitType mark_ship_hit(HitMap* hitmap, Map* playerMap, Position pos);
 
 void print_maps(HitMap cpuMap, HitMap playerMap, FILE* out);
 void print_hitmap(HitMap map, FILE* stream, bool hideMisses);
-void print_hub_maps(HitMap playerOneMap, HitMap playerTwoMap, int round);
+char* render_hitmap(HitMap map, bool hideMisses, size_t* size);
+size_t rendered_cell_offset(HitMap map, Position pos);
+char* hit_tag(HitType hit);
+void print_result(GameState* state, HitType hit, int id, Position pos);
+void note_changes(GameState* state, int map, Position* cells, int numCells);
+void print_round_maps(GameState* state, int round);
+void print_game_over(GameState* state, int round, int winner);
+bool read_output_mode(const char* name, OutputMode* mode);
 void mark_ships(HitMap* map, Map playerMap);
+void mark_ship_cell(HitMap* map, Position pos, int ship);
+int get_ship_id(HitMap map, Position pos);
+char ship_glyph(int ship);
 void update_ship_lengths(Rules* rules, Map map);
+void update_ship_length(Ship* ship, int newLength);
 
 void add_ship(Map* map, Ship ship);
 Ship new_ship(int length, Position pos, Direction dir);
 
 bool all_ships_sunk(Map map);
+bool build_occupancy(Map* map, Rules rules);
+bool is_sparse_board(int rows, int cols);
+CellTable empty_cell_table(void);
+int get_cell_value(CellTable* table, int cell);
+void set_cell_value(CellTable* table, int cell, int value);
+void free_cell_table(CellTable* table);
+int count_unguessed(HitMap map);
+int next_open_cell(HitMap map, int from);
+int prev_open_cell(HitMap map, int from);
 
 Map empty_map(void);
 
@@ -9,26 +9,151 @@
 #include <fcntl.h>
 #include <string.h>
 #include <ctype.h>
+#include <poll.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <dlfcn.h>
+
+#include "metrics.h"
+#include "plugin.h"
+#include "transcript.h"
 
 #define PIPE_READ 0
 #define PIPE_WRITE 1
+#define NO_MESSAGE -1
 
 // needed to handling signals (SIGHUP)
 Rounds* globalRounds;
 
+// recorded by every worker, and written on SIGUSR1 and at exit
+Metrics hubMetrics;
+
+/**
+ * Options given to the hub on the command line.
+ * - jobs: the number of worker threads playing rounds
+ * - shareAgents: play every round of a worker with the same program, map
+ *   and player id on one agent process
+ * - binary: switch agent processes to the binary protocol after setup
+ * - output: how much of each round is written to stdout
+ * - recordPath: where to write a binary transcript, NULL for none
+ * - metricsPath: where to write the metrics, NULL for stderr
+ */
+typedef struct HubOptions {
+    int jobs;
+    bool shareAgents;
+    bool binary;
+    OutputMode output;
+    char* recordPath;
+    char* metricsPath;
+} HubOptions;
+
+/**
+ * A plugin library loaded by the hub.
+ * - path: the path the library was loaded from
+ * - library: the handle returned by dlopen()
+ * - plugin: the agent functions the library exports
+ */
+typedef struct PluginLibrary {
+    char* path;
+    void* library;
+    const AgentPlugin* plugin;
+} PluginLibrary;
+
+/**
+ * Everything the hub starts while setting up the rounds.
+ * - options: the options of the hub
+ * - processes: the agent processes started so far
+ * - numProcesses: the number of agent processes
+ * - libraries: the plugin libraries loaded so far
+ * - numLibraries: the number of plugin libraries
+ */
+typedef struct Launcher {
+    HubOptions options;
+    AgentProcess** processes;
+    int numProcesses;
+    PluginLibrary* libraries;
+    int numLibraries;
+} Launcher;
+
+/**
+ * The output of rounds played by several workers. Each round writes its
+ * transcript to its own buffer, which is committed to stdout once every
+ * earlier round has been committed, so the output does not depend on how
+ * the workers were scheduled.
+ * - lock: guards the fields below
+ * - buffers: the buffered transcript of each round
+ * - sizes: the size of each buffer
+ * - finished: which rounds have finished writing their transcript
+ * - nextRound: the first round not yet committed
+ */
+typedef struct Transcript {
+    pthread_mutex_t lock;
+    char** buffers;
+    size_t* sizes;
+    bool* finished;
+    int nextRound;
+} Transcript;
+
+/**
+ * A binary transcript being recorded (see transcript.h). The shots of each
+ * round are gathered separately, and the round is written as one block when
+ * it finishes.
+ * - lock: guards stream, which is shared by the workers
+ * - stream: the transcript file
+ * - shots: the shots of each round so far
+ * - numShots: the number of shots of each round
+ */
+typedef struct Recorder {
+    pthread_mutex_t lock;
+    FILE* stream;
+    ByteBuffer* shots;
+    int* numShots;
+} Recorder;
+
 /**
- * Kill the agents of a round (game).
+ * A worker playing a share of the rounds: rounds first, first + step, ...
+ * - thread: the thread running the worker
+ * - rounds: all rounds of the game
+ * - first: the first round of this worker
+ * - step: the distance between the rounds of this worker
+ * - transcript: where finished rounds are committed, NULL if the rounds
+ *   write straight to stdout
+ * - recorder: the binary transcript, NULL if none is being recorded
+ * - status: the result of playing the rounds
+ */
+typedef struct Worker {
+    pthread_t thread;
+    Rounds* rounds;
+    int first;
+    int step;
+    Transcript* transcript;
+    Recorder* recorder;
+    HubStatus status;
+} Worker;
+
+/**
+ * Kill an agent process.
  *
- * state (GameState*): the game state with those agents
+ * process (AgentProcess*): the process to kill
  *
  */
-void kill_children(GameState* state) {
-    for (int agent = 0; agent < NUM_AGENTS; agent++) {
-        int pid = state->info.agents[agent].pid;
-        if (waitpid(pid, 0, WNOHANG) == 0) {
-            // check if child is still running
-            kill(pid, SIGKILL);
-        }
+void kill_process(AgentProcess* process) {
+    if (waitpid(process->pid, 0, WNOHANG) == 0) {
+        // check if child is still running
+        kill(process->pid, SIGKILL);
+    }
+}
+
+/**
+ * Kill every agent process of the rounds.
+ *
+ * rounds (Rounds*): the rounds with those processes
+ *
+ */
+void kill_children(Rounds* rounds) {
+    for (int i = 0; i < rounds->numProcesses; i++) {
+        kill_process(rounds->processes[i]);
     }       
 }
 
@@ -42,9 +167,13 @@ void kill_children(GameState* state) {
  *
  */
 void hub_exit(HubStatus err, Rounds* rounds) {
+    // SIGHUP exits from the signal thread, so the main thread may be exiting
+    // too; whichever is second waits here for the process to end
+    static pthread_mutex_t exiting = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&exiting);
     switch (err) {
         case INCORRECT_ARG_COUNT:
-            fprintf(stderr, "Usage: 2310hub rules config\n");
+            fprintf(stderr, "Usage: 2310hub [options] rules config\n");
             break;
         case INVALID_RULES:
             fprintf(stderr, "Error reading rules\n");
@@ -65,15 +194,43 @@ void hub_exit(HubStatus err, Rounds* rounds) {
             break;
     }
     
+    // without a file, the metrics are only worth printing once rounds exist
+    if (hubMetrics.path != NULL || rounds != NULL) {
+        dump_metrics(&hubMetrics);
+    }
     if (rounds != NULL) {
+        kill_children(rounds);
+    }
+    // on SIGHUP the workers may still be playing, so nothing is freed
+    if (rounds != NULL && err != GOT_SIGHUP) {
         for (int round = 0; round < rounds->rounds; round++) {
-            kill_children(&rounds->states[round]);
             free_game(&rounds->states[round]);
         }
+        for (int i = 0; i < rounds->numProcesses; i++) {
+            free_process(rounds->processes[i]);
+        }
     }
     exit(err);
 }
 
+/**
+ * Exit the hub while the rounds are being set up, killing and freeing the
+ * agent processes started so far.
+ *
+ * err (HubStatus): the exit code to exit with
+ * launcher (Launcher*): what has been started
+ *
+ * Exits with code `err`.
+ *
+ */
+void abandon_setup(HubStatus err, Launcher* launcher) {
+    for (int i = 0; i < launcher->numProcesses; i++) {
+        kill_process(launcher->processes[i]);
+        free_process(launcher->processes[i]);
+    }
+    hub_exit(err, NULL);
+}
+
 /**
  * Send the RULES message to an agent.
  *
@@ -82,13 +239,17 @@ void hub_exit(HubStatus err, Rounds* rounds) {
  *
  */
 void send_rules_message(Rules rules, Agent* agent) {
-    fprintf(agent->in, "RULES %d,%d,%d", rules.numCols, rules.numRows, 
-            rules.numShips);
+    FILE* in = agent->process->in;
+    print_tag(in, "RULES", agent->game);
+    fprintf(in, " %d,%d,%d", rules.numCols, rules.numRows, rules.numShips);
     for (int i = 0; i < rules.numShips; i++) {
-        fprintf(agent->in, ",%d", rules.shipLengths[i]);
+        fprintf(in, ",%d", rules.shipLengths[i]);
     }
-    fprintf(agent->in, "\n");
-    fflush(agent->in);
+    if (rules.salvo > 1) {
+        fprintf(in, " %d", rules.salvo);
+    }
+    fprintf(in, "\n");
+    fflush(in);
 }
 
 /**
@@ -98,150 +259,257 @@ void send_rules_message(Rules rules, Agent* agent) {
  *
  */
 void send_yt(Agent* agent) {
-    fprintf(agent->in, "YT\n");
-    fflush(agent->in);
+    if (agent->process->binary) {
+        Position none = {0, 0};
+        write_record(agent->process->in, new_record(WIRE_YT, 0, agent->game,
+                none));
+    } else {
+        print_tag(agent->process->in, "YT", agent->game);
+        fprintf(agent->process->in, "\n");
+    }
+    fflush(agent->process->in);
+}
+
+/**
+ * Read a line from an agent process, waiting until a complete line has 
+ * arrived.
+ *
+ * process (AgentProcess*): the process to read from
+ *
+ * Returns the line read, or NULL if the process closed its pipe or it could
+ * not be read. The line is a view into the buffer of the process.
+ *
+ */
+char* read_agent_line(AgentProcess* process) {
+    char* line;
+    while ((line = next_buffered_line(&process->buffer)) == NULL) {
+        int numRead = fill_line_buffer(&process->buffer, process->out);
+        if (numRead <= 0) {
+            return NULL;
+        }
+        count(&hubMetrics, COUNT_BYTES_RECEIVED, numRead);
+    }
+    return line;
 }
 
 /**
  * Read the MAP message from an agent.
  *
  * map (Map*): the map to update
- * stream (FILE*): the stream to read from
+ * agent (Agent*): the agent to read from
  *
  * Returns NORMAL on success otherwise a COMM_ERR.
  *
  */
-HubStatus read_map_message(Map* map, FILE* stream) {
-    char* line;
-    if ((line = read_line(stream)) == NULL || !check_tag("MAP ", line)) {
-        free(line);
+HubStatus read_map_message(Map* map, Agent* agent) {
+    char* line = read_agent_line(agent->process);
+    if (line == NULL) {
+        return COMM_ERR;
+    }
+    Tokenizer tokens = new_tokenizer(line);
+    if (!take_word(&tokens, "MAP") || take_game(&tokens) != agent->game) {
         return COMM_ERR;
     }
+
+    // each ship is a position and a direction, e.g. "A1,S:C3,E:H8,N"
     Map newMap = empty_map();
-    int index = 0; // where we are in the line
-    index += strlen("MAP ");
-    while (true) {
-        int count = 0;
-        while (line[index] != '\0') { // until we reach the end of the line
-            char col, row, direction;
-            if (line[index] == ' ') {
-                index++;
-                continue;
-            }
-            if (count == 0) { // looking for the column
-                col = line[index++];
-                count++;
-            } else if (count == 1) { // looking for the row
-                row = line[index++];
-                while (line[index] != ',') {
-                    if (!isspace(line[index])) {
-                        return COMM_ERR;
-                    }
-                    index++;
-                }
-                index++;
-                count++;
-            } else if (count == 2) {
-                direction = line[index++];
-                if (!validate_ship_info(col, row, direction)) {
-                    return COMM_ERR;
-                }
-                add_ship(&newMap, new_ship(0, new_position(col, 
-                        (int) row - '0'), (Direction) direction));
-                count++;
-            } else if (line[index] == ':') {
-                index++;
-                break;
-            }
-        }
-        if (line[index] == '\0') {
-            break;
+    do {
+        Position pos;
+        char direction;
+        if (!take_position(&tokens, &pos) || !take_char(&tokens, ',') || 
+                !take_letter(&tokens, &direction) || 
+                !is_valid_direction(direction)) {
+            free_map(&newMap);
+            return COMM_ERR;
         }
+        add_ship(&newMap, new_ship(0, pos, (Direction) direction));
+    } while (take_char(&tokens, ':'));
+    if (!at_end(&tokens)) {
+        free_map(&newMap);
+        return COMM_ERR;
     }
-    free(line);
     memcpy(map, &newMap, sizeof(Map));
     return NORMAL;
 }
 
+/**
+ * Get the record type of the binary protocol reporting a hit type.
+ *
+ * hit (HitType): the type of hit
+ *
+ * Returns WIRE_HIT, WIRE_SUNK or WIRE_MISS.
+ *
+ */
+WireType hit_record_type(HitType hit) {
+    if (hit == HIT_HIT) {
+        return WIRE_HIT;
+    } else if (hit == HIT_SUNK) {
+        return WIRE_SUNK;
+    }
+    return WIRE_MISS;
+}
+
+/**
+ * Tell the agent that guessed its guess was accepted, if it is an agent
+ * process. The stream is not flushed.
+ *
+ * agent (Agent*): the agent that guessed
+ * id (int): the id of the agent
+ * pos (Position): the position guessed
+ *
+ */
+void send_ok(Agent* agent, int id, Position pos) {
+    if (agent->process == NULL) {
+        return;
+    }
+    if (agent->process->binary) {
+        write_record(agent->process->in, new_record(WIRE_OK, id, agent->game, 
+                pos));
+    } else {
+        print_tag(agent->process->in, "OK", agent->game);
+        fprintf(agent->process->in, "\n");
+    }
+}
+
 /**
  * Sends a hit message to the agents.
  *
- * type (char*): the type of hit as a string
- * info (GameInfo): the info for this game
+ * hit (HitType): the type of hit
+ * state (GameState*): the state of this game
  * id (int): the id of the hitting agent
- * row (int): the row being hit
- * col (int): the column being hit
+ * pos (Position): the position being hit
  *
  */
-void send_hit_message(char* type, GameInfo info, int id, int row, int col) {
-    fprintf(info.agents[id - 1].in, "OK\n");
-    fprintf(info.agents[0].in, "%s %d,%c%d\n", type, id, col, row);
-    fprintf(info.agents[1].in, "%s %d,%c%d\n", type, id, col, row);
-    if (!strcmp(type, "SUNK")) {
-        printf("SHIP %s player %d guessed %c%d\n", type, id, col, row);
-    } else {
-        printf("%s player %d guessed %c%d\n", type, id, col, row);
+void send_hit_message(HitType hit, GameState* state, int id, Position pos) {
+    Agent* agents = state->info.agents;
+    send_ok(&agents[id - 1], id, pos);
+    for (int agent = 0; agent < NUM_AGENTS; agent++) {
+        AgentProcess* process = agents[agent].process;
+        if (process == NULL) {
+            agents[agent].plugin->on_result(agents[agent].handle, id, pos, 
+                    hit);
+            continue;
+        }
+        if (process->binary) {
+            write_record(process->in, new_record(hit_record_type(hit), id, 
+                    agents[agent].game, pos));
+        } else {
+            char text[MAX_POSITION_LENGTH];
+            print_tag(process->in, hit_tag(hit), agents[agent].game);
+            fprintf(process->in, " %d,%s\n", id, format_position(pos, text));
+        }
+        fflush(process->in);
     }
-    fflush(info.agents[0].in);
-    fflush(info.agents[1].in);
+    print_result(state, hit, id, pos);
 }
 
 /**
- * Read a GUESS message from the agent.
+ * Sends the results of a salvo to the agents as one SALVO message, e.g.
+ * "SALVO 1,A1:HIT,B2:MISS,C3:SUNK".
  *
- * state (GameState*): the state of this agent
- * id (int): the id of this agent
+ * state (GameState*): the state of this game
+ * id (int): the id of the hitting agent
+ * shots (Position*): the positions hit
+ * hits (HitType*): the type of hit at each position
+ * numShots (int): the number of shots
+ *
+ */
+void send_salvo_message(GameState* state, int id, Position* shots, 
+        HitType* hits, int numShots) {
+    Agent* agents = state->info.agents;
+    send_ok(&agents[id - 1], id, shots[0]);
+    for (int agent = 0; agent < NUM_AGENTS; agent++) {
+        AgentProcess* process = agents[agent].process;
+        if (process == NULL) {
+            for (int shot = 0; shot < numShots; shot++) {
+                agents[agent].plugin->on_result(agents[agent].handle, id, 
+                        shots[shot], hits[shot]);
+            }
+            continue;
+        }
+        if (process->binary) {
+            Position count = {numShots, 0};
+            write_record(process->in, new_record(WIRE_SALVO, id, 
+                    agents[agent].game, count));
+            for (int shot = 0; shot < numShots; shot++) {
+                write_record(process->in, new_record(
+                        hit_record_type(hits[shot]), id, agents[agent].game,
+                        shots[shot]));
+            }
+        } else {
+            print_tag(process->in, "SALVO", agents[agent].game);
+            fprintf(process->in, " %d", id);
+            for (int shot = 0; shot < numShots; shot++) {
+                char text[MAX_POSITION_LENGTH];
+                fprintf(process->in, ",%s:%s", 
+                        format_position(shots[shot], text), 
+                        hit_tag(hits[shot]));
+            }
+            fprintf(process->in, "\n");
+        }
+        fflush(process->in);
+    }
+    for (int shot = 0; shot < numShots; shot++) {
+        print_result(state, hits[shot], id, shots[shot]);
+    }
+}
+
+/**
+ * Read the positions of a GUESS message from the agent, which holds one
+ * position for each shot of the salvo separated by commas, e.g. 
+ * "GUESS A1,B2,C3".
+ *
+ * tokens (Tokenizer*): the message, after its tag and game id
+ * shots (Position*): the positions guessed (to be modified)
+ * numShots (int): the number of shots the agent must take
  *
  * Returns NORMAL if successful, otherwise a COMM_ERR.
  *
  */
-HubStatus read_guess_message(GameState* state, int id, HitType* hitType) {
-    char* line;
-    if ((line = read_line(state->info.agents[id - 1].out)) == NULL 
-            || !check_tag("GUESS ", line)) {
-        free(line);
-        return COMM_ERR;
+HubStatus read_guess_message(Tokenizer* tokens, Position* shots, 
+        int numShots) {
+    for (int shot = 0; shot < numShots; shot++) {
+        if ((shot > 0 && !take_char(tokens, ',')) || 
+                !take_position(tokens, &shots[shot])) {
+            return COMM_ERR;
+        }
     }
+    return at_end(tokens) ? NORMAL : COMM_ERR;
+}
 
-    char col;
-    int row;
-    if (sscanf(line, "GUESS %c%d", &col, &row) != 2) {
-        free(line);
+/**
+ * Resolve a guess made by an agent.
+ *
+ * state (GameState*): the state of this game
+ * id (int): the id of the guessing agent
+ * pos (Position): the position guessed
+ * hitType (HitType*): the type of hit made by the guess (to be modified)
+ *
+ * Returns NORMAL if successful, otherwise a COMM_ERR if the guess is off the
+ * board.
+ *
+ */
+HubStatus resolve_guess(GameState* state, int id, Position pos, 
+        HitType* hitType) {
+    if (!position_in_bounds(state->info.rules, pos)) {
         return COMM_ERR;
     }
-    HitType hit;
-    if (id == 1) {
-        hit = mark_ship_hit(&state->maps[1], 
-                &state->info.agents[1].map, new_position(col, row));
-    } else if (id == 2) {
-        hit = mark_ship_hit(&state->maps[0], 
-                &state->info.agents[0].map, new_position(col, row));
-    }
-    
-    if (hit == HIT_HIT) {
-        send_hit_message("HIT", state->info, id, row, col);
-    } else if (hit == HIT_MISS) {
-        send_hit_message("MISS", state->info, id, row, col);
-    } else if (hit == HIT_SUNK) {
-        send_hit_message("SUNK", state->info, id, row, col);
-    }
-    free(line);
-    *hitType = hit;
+    *hitType = mark_ship_hit(&state->maps[id % NUM_AGENTS], 
+            &state->info.agents[id % NUM_AGENTS].map, pos);
     return NORMAL;
 }
 
 /**
  * Create a child process for an agent.
  *
- * id (int): the id of the agent
- * round (int): the current round of the game
- * agent (Agent*): the agent to start
+ * process (AgentProcess*): the process to start
+ * round (int): the first round played by the process
  *
  * Returns NORMAL if success, or AGENT_ERR if there is a problem starting the
  * child.
  *
  */
-HubStatus create_child(int id, int round, Agent* agent) {
+HubStatus create_child(AgentProcess* process, int round) {
     int pipeIn[2], pipeOut[2], pipeErr[2];
     int pid;
 
@@ -254,9 +522,12 @@ HubStatus create_child(int id, int round, Agent* agent) {
     }
 
     if (pid) { // Parent
-        agent->pid = pid;
-        agent->in = fdopen(pipeIn[PIPE_WRITE], "w");
-        agent->out = fdopen(pipeOut[PIPE_READ], "r");
+        process->pid = pid;
+        process->in = open_counted_stream(pipeIn[PIPE_WRITE], &hubMetrics);
+        process->out = pipeOut[PIPE_READ];
+        // later agents must not inherit our ends of the pipes
+        fcntl(pipeIn[PIPE_WRITE], F_SETFD, FD_CLOEXEC);
+        fcntl(pipeOut[PIPE_READ], F_SETFD, FD_CLOEXEC);
 
         close(pipeIn[PIPE_READ]);
         close(pipeOut[PIPE_WRITE]);
@@ -268,6 +539,10 @@ HubStatus create_child(int id, int round, Agent* agent) {
         close(pipeErr[PIPE_READ]);
         return NORMAL;
     } else { // Child
+        // SIGHUP and SIGUSR1 are only blocked for the hub's signal thread
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigprocmask(SIG_SETMASK, &signals, NULL);
         // Read from stdin
         dup2(pipeIn[PIPE_READ], STDIN_FILENO);
         // Write to stdout
@@ -281,11 +556,13 @@ HubStatus create_child(int id, int round, Agent* agent) {
         close(pipeErr[PIPE_READ]);
         fcntl(pipeErr[PIPE_WRITE], F_SETFD, FD_CLOEXEC);
         
-        char execId[4], execSeed[4]; // need to convert to strings
-        sprintf(execId, "%d", id);
-        sprintf(execSeed, "%d", 2 * round + id);
-        execlp(agent->programPath, agent->programPath, execId, agent->mapPath, 
-                execSeed, NULL);
+        char execId[12], execSeed[12]; // need to convert to strings
+        sprintf(execId, "%d", process->id);
+        // a shared agent offsets the seed by each game it plays
+        sprintf(execSeed, "%d", 
+                2 * (process->shared ? 0 : round) + process->id);
+        execlp(process->programPath, process->programPath, execId, 
+                process->mapPath, execSeed, NULL);
         char dummy = 0;
         write(pipeErr[PIPE_WRITE], &dummy, sizeof(dummy)); // write to check
     }
@@ -293,137 +570,905 @@ HubStatus create_child(int id, int round, Agent* agent) {
 }
 
 /**
- * Create child processes for each agent.
+ * Checks if an agent program is a plugin library rather than an executable.
  *
- * info (GameInfo*): the game info, contains information about the processes
- * round (int): the round associated with these agents
+ * programPath (char*): the path of the program
+ *
+ * Returns true if the path names a shared library (ends in ".so").
+ *
+ */
+bool is_plugin_path(char* programPath) {
+    int length = strlen(programPath);
+    return length > 3 && !strcmp(programPath + length - 3, ".so");
+}
+
+/**
+ * Load a plugin library, unless it has been loaded already.
+ *
+ * path (char*): the path of the library
+ * launcher (Launcher*): the libraries loaded so far
+ *
+ * Returns the functions of the plugin, or NULL if it could not be loaded.
  *
- * Returns NORMAL On success otherwise an AGENT_ERR.
  */
-HubStatus create_children(GameInfo* info, int round) {
-    if (create_child(1, round, &info->agents[0]) == AGENT_ERR ||   
-            create_child(2, round, &info->agents[1]) == AGENT_ERR) {
+const AgentPlugin* load_plugin(char* path, Launcher* launcher) {
+    for (int i = 0; i < launcher->numLibraries; i++) {
+        if (!strcmp(launcher->libraries[i].path, path)) {
+            return launcher->libraries[i].plugin;
+        }
+    }
+    void* library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (library == NULL) {
+        return NULL;
+    }
+    const AgentPlugin* plugin = dlsym(library, AGENT_PLUGIN_SYMBOL);
+    if (plugin == NULL || plugin->version != AGENT_PLUGIN_VERSION) {
+        dlclose(library);
+        return NULL;
+    }
+    launcher->libraries = realloc(launcher->libraries, 
+            sizeof(PluginLibrary) * (launcher->numLibraries + 1));
+    PluginLibrary* loaded = &launcher->libraries[launcher->numLibraries++];
+    loaded->path = strdup(path);
+    loaded->library = library;
+    loaded->plugin = plugin;
+    return plugin;
+}
+
+/**
+ * Start an agent in-process from its plugin library.
+ *
+ * agent (Agent*): the agent to start
+ * id (int): the player id of the agent
+ * round (int): the round the agent plays in
+ * launcher (Launcher*): the libraries loaded so far
+ *
+ * Returns NORMAL on success otherwise an AGENT_ERR.
+ *
+ */
+HubStatus start_plugin(Agent* agent, int id, int round, Launcher* launcher) {
+    agent->process = NULL;
+    agent->game = NO_GAME;
+    agent->plugin = load_plugin(agent->programPath, launcher);
+    if (agent->plugin == NULL) {
+        return AGENT_ERR;
+    }
+    agent->handle = agent->plugin->init(id, agent->mapPath, 2 * round + id);
+    if (agent->handle == NULL) {
         return AGENT_ERR;
     }
     return NORMAL;
 }
 
 /**
- * SIGHUP handler. Exits with GOT_SIGHUP. Frees the game state.
+ * Find the process to play as an agent in a round, starting one if needed.
+ * Shared processes are reused by every round of the same worker with the
+ * same program, map and player id.
+ *
+ * agent (Agent*): the agent to find a process for
+ * id (int): the player id of the agent
+ * round (int): the round the agent plays in
+ * launcher (Launcher*): the processes started so far
+ *
+ * Returns NORMAL on success otherwise an AGENT_ERR.
+ *
  */
-void handle_sighup() {
-    hub_exit(GOT_SIGHUP, globalRounds);
+HubStatus assign_process(Agent* agent, int id, int round, 
+        Launcher* launcher) {
+    HubOptions* options = &launcher->options;
+    int worker = round % options->jobs;
+    agent->plugin = NULL;
+    agent->handle = NULL;
+    for (int i = 0; options->shareAgents && i < launcher->numProcesses; i++) {
+        AgentProcess* process = launcher->processes[i];
+        if (process->id == id && process->worker == worker && 
+                !strcmp(process->programPath, agent->programPath) &&
+                !strcmp(process->mapPath, agent->mapPath)) {
+            process->activeGames++;
+            agent->process = process;
+            agent->game = round;
+            return NORMAL;
+        }
+    }
+
+    AgentProcess* process = malloc(sizeof(AgentProcess));
+    process->programPath = strdup(agent->programPath);
+    process->mapPath = strdup(agent->mapPath);
+    process->id = id;
+    process->in = NULL;
+    process->buffer = empty_line_buffer();
+    process->shared = options->shareAgents;
+    process->binary = false;
+    process->round = round;
+    process->activeGames = 1;
+    process->worker = worker;
+    launcher->processes = realloc(launcher->processes, 
+            sizeof(AgentProcess*) * (launcher->numProcesses + 1));
+    launcher->processes[launcher->numProcesses++] = process;
+
+    agent->process = process;
+    agent->game = process->shared ? round : NO_GAME;
+    long start = now_ns();
+    HubStatus status = create_child(process, round);
+    observe(&hubMetrics.programs[agent->program].starts, now_ns() - start);
+    return status;
 }
 
 /**
- * Checks if there are still rounds in progress.
+ * Start each agent of a round, then send it the rules and read its map.
  *
- * rounds (Round*): the rounds to check
- * 
- * Returns true if there are rounds in progress.
+ * info (GameInfo*): the game info, contains information about the agents
+ * round (int): the round associated with these agents
+ * launcher (Launcher*): what has been started so far
  *
+ * Returns NORMAL on success otherwise the error to exit with.
  */
-bool rounds_in_progress(Rounds* rounds) {
-    for (int round = 0; round < rounds->rounds; round++) {
-        if (rounds->inProgress[round]) {
-            return true;
+HubStatus setup_round(GameInfo* info, int round, Launcher* launcher) {
+    for (int id = 1; id <= NUM_AGENTS; id++) {
+        Agent* agent = &info->agents[id - 1];
+        agent->program = metrics_program(&hubMetrics, agent->programPath);
+        HubStatus status;
+        if (is_plugin_path(agent->programPath)) {
+            status = start_plugin(agent, id, round, launcher);
+        } else {
+            status = assign_process(agent, id, round, launcher);
         }
+        if (status != NORMAL) {
+            return AGENT_ERR;
+        }
+    }
+
+    for (int id = 1; id <= NUM_AGENTS; id++) {
+        Agent* agent = &info->agents[id - 1];
+        Histogram* maps = &hubMetrics.programs[agent->program].maps;
+        long start = now_ns();
+        if (agent->plugin != NULL) {
+            agent->map = empty_map();
+            if (!agent->plugin->on_rules(agent->handle, &info->rules, 
+                    &agent->map)) {
+                return COMM_ERR;
+            }
+            observe(maps, now_ns() - start);
+            continue;
+        }
+        send_rules_message(info->rules, agent);
+        HubStatus status = read_map_message(&agent->map, agent);
+        if (status != NORMAL) {
+            return status;
+        }
+        observe(maps, now_ns() - start);
+    }
+
+    long start = now_ns();
+    HubStatus status = validate_info(info);
+    observe(&hubMetrics.validations, now_ns() - start);
+    return status;
+}
+
+/**
+ * Switch every agent process to the binary protocol. The hub asks with a
+ * BINARY line and the agent agrees by sending one back, after which both
+ * sides only send records.
+ *
+ * launcher (Launcher*): the processes to switch
+ *
+ * Returns NORMAL on success otherwise a COMM_ERR.
+ */
+HubStatus negotiate_binary(Launcher* launcher) {
+    for (int i = 0; i < launcher->numProcesses; i++) {
+        AgentProcess* process = launcher->processes[i];
+        fprintf(process->in, "BINARY\n");
+        fflush(process->in);
+        char* line = read_agent_line(process);
+        if (line == NULL || strcmp(line, "BINARY")) {
+            return COMM_ERR;
+        }
+        process->binary = true;
+    }
+    return NORMAL;
+}
+
+/**
+ * Thread entry point that handles the signals sent to the hub. SIGHUP
+ * exits with GOT_SIGHUP, and SIGUSR1 writes the metrics. Every other thread
+ * blocks both, so neither is ever handled inside a signal handler.
+ *
+ * arg (void*): the signals to wait for
+ *
+ * Returns NULL.
+ *
+ */
+void* handle_signals(void* arg) {
+    int signal;
+    while (sigwait(arg, &signal) == 0) {
+        if (signal == SIGHUP) {
+            hub_exit(GOT_SIGHUP, globalRounds);
+        }
+        dump_metrics(&hubMetrics);
     }
-    return false;
+    return NULL;
 }
 
 /**
- * Start the hub execution.
+ * Open the file for a binary transcript and write its header.
+ *
+ * recorder (Recorder*): the recorder to set up
+ * path (char*): the location of the transcript
+ * rules (Rules): the rules of every round
+ * numRounds (int): the number of rounds
+ *
+ * Returns true if successful, else returns false.
+ *
+ */
+bool start_recording(Recorder* recorder, char* path, Rules rules, 
+        int numRounds) {
+    if ((recorder->stream = fopen(path, "wb")) == NULL) {
+        return false;
+    }
+    pthread_mutex_init(&recorder->lock, NULL);
+    recorder->shots = malloc(sizeof(ByteBuffer) * numRounds);
+    recorder->numShots = calloc(numRounds, sizeof(int));
+    for (int round = 0; round < numRounds; round++) {
+        recorder->shots[round] = empty_byte_buffer();
+    }
+    write_transcript_header(recorder->stream, rules, numRounds);
+    return true;
+}
+
+/**
+ * Add the shots of a salvo to the binary transcript of a round. Only the
+ * worker playing the round touches its shots, so no lock is needed.
+ *
+ * recorder (Recorder*): the recorder, or NULL if not recording
+ * state (GameState*): the state of the round
+ * round (int): the number of the round
+ * id (int): the id of the agent that took the salvo
+ * shots (Position*): the positions hit
+ * hits (HitType*): the type of hit at each position
+ * numShots (int): the number of shots
  *
+ */
+void record_salvo(Recorder* recorder, GameState* state, int round, int id,
+        Position* shots, HitType* hits, int numShots) {
+    if (recorder == NULL) {
+        return;
+    }
+    for (int shot = 0; shot < numShots; shot++) {
+        record_shot(&recorder->shots[round], state->info.rules, id, 
+                shots[shot], hits[shot]);
+    }
+    recorder->numShots[round] += numShots;
+}
+
+/**
+ * Write a finished round to the binary transcript.
+ *
+ * recorder (Recorder*): the recorder, or NULL if not recording
+ * state (GameState*): the state of the round
+ * round (int): the number of the round
+ * winner (int): the id of the winning agent
+ *
+ */
+void record_round(Recorder* recorder, GameState* state, int round, 
+        int winner) {
+    if (recorder == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&recorder->lock);
+    write_transcript_game(recorder->stream, state, round, winner, 
+            &recorder->shots[round], recorder->numShots[round]);
+    pthread_mutex_unlock(&recorder->lock);
+    free_byte_buffer(&recorder->shots[round]);
+}
+
+/**
+ * Close the file of a binary transcript and free the recorder.
+ *
+ * recorder (Recorder*): the recorder to stop
+ * numRounds (int): the number of rounds
+ *
+ */
+void stop_recording(Recorder* recorder, int numRounds) {
+    fclose(recorder->stream);
+    for (int round = 0; round < numRounds; round++) {
+        free_byte_buffer(&recorder->shots[round]);
+    }
+    free(recorder->shots);
+    free(recorder->numShots);
+    pthread_mutex_destroy(&recorder->lock);
+}
+
+/**
+ * Prompt the agent whose turn it is in a round. The maps of the round are
+ * printed first whenever a new pair of turns begins, in full or as the
+ * cells that have changed depending on the output mode.
+ *
+ * state (GameState*): the state of the round
+ * round (int): the number of the round
+ *
+ */
+void start_turn(GameState* state, int round) {
+    if (state->turn == 0) {
+        print_round_maps(state, round);
+    }
+    if (state->info.agents[state->turn].process != NULL) {
+        state->turnStarted = now_ns();
+        send_yt(&state->info.agents[state->turn]);
+    }
+}
+
+/**
+ * Commit the transcript of a finished round, along with those of any later
+ * rounds that were only waiting on it.
+ *
+ * transcript (Transcript*): the transcript of all rounds
  * rounds (Rounds*): the rounds for this game
+ * round (int): the round that has finished
  *
- * Returns NORMAL if successful.
+ */
+void commit_round(Transcript* transcript, Rounds* rounds, int round) {
+    fclose(rounds->states[round].out);
+    rounds->states[round].out = NULL;
+
+    pthread_mutex_lock(&transcript->lock);
+    transcript->finished[round] = true;
+    while (transcript->nextRound < rounds->rounds && 
+            transcript->finished[transcript->nextRound]) {
+        int next = transcript->nextRound++;
+        fwrite(transcript->buffers[next], sizeof(char), 
+                transcript->sizes[next], stdout);
+        free(transcript->buffers[next]);
+        transcript->buffers[next] = NULL;
+    }
+    fflush(stdout);
+    pthread_mutex_unlock(&transcript->lock);
+}
+
+/**
+ * End a round, telling both agents who won.
+ *
+ * worker (Worker*): the worker playing the round
+ * round (int): the round that is over
+ * winner (int): the id of the winning agent
+ *
+ */
+void end_round(Worker* worker, int round, int winner) {
+    GameState* state = &worker->rounds->states[round];
+    for (int agent = 0; agent < NUM_AGENTS; agent++) {
+        AgentProcess* process = state->info.agents[agent].process;
+        if (process == NULL) {
+            state->info.agents[agent].plugin->free(
+                    state->info.agents[agent].handle);
+            continue;
+        }
+        if (process->binary) {
+            Position none = {0, 0};
+            write_record(process->in, new_record(WIRE_DONE, winner, 
+                    state->info.agents[agent].game, none));
+        } else {
+            print_tag(process->in, "DONE", state->info.agents[agent].game);
+            fprintf(process->in, " %d\n", winner);
+        }
+        fflush(process->in);
+        if (--process->activeGames == 0) {
+            kill_process(process);
+        }
+    }
+    record_round(worker->recorder, state, round, winner);
+    count(&hubMetrics, COUNT_GAMES_FINISHED, 1);
+    print_game_over(state, round, winner);
+    worker->rounds->inProgress[round] = false; // game is over
+    if (worker->transcript != NULL) {
+        commit_round(worker->transcript, worker->rounds, round);
+    }
+}
+
+/**
+ * Find the number of shots the agent whose turn it is takes in a round: the
+ * salvo of the rules, or every cell it has not yet guessed if there are
+ * fewer.
+ *
+ * state (GameState*): the state of the round
+ *
+ * Returns the number of shots.
+ *
+ */
+int salvo_size(GameState* state) {
+    int unguessed = count_unguessed(state->maps[(state->turn + 1) % 
+            NUM_AGENTS]);
+    return unguessed < state->info.rules.salvo ? unguessed : 
+            state->info.rules.salvo;
+}
+
+/**
+ * Play the salvo held in the state of a round by the agent whose turn it
+ * is, then move the round on to its next turn (or end it). Shots at cells
+ * already guessed are dropped; if every shot is dropped the agent guesses
+ * again.
+ *
+ * worker (Worker*): the worker playing the round
+ * round (int): the round the salvo belongs to
+ *
+ * Returns NORMAL if successful, otherwise a COMM_ERR.
+ *
+ */
+HubStatus play_salvo(Worker* worker, int round) {
+    GameState* state = &worker->rounds->states[round];
+    int agent = state->turn;
+    int numShots = state->numShots;
+    HitType hits[numShots];
+    int numHits = 0;
+
+    state->numShots = 0;
+    for (int shot = 0; shot < numShots; shot++) {
+        if (resolve_guess(state, agent + 1, state->shots[shot], 
+                &hits[numHits]) != NORMAL) {
+            return COMM_ERR;
+        }
+        if (hits[numHits] != HIT_REHIT) {
+            state->shots[numHits++] = state->shots[shot];
+        }
+    }
+    count(&hubMetrics, COUNT_SHOTS, numShots);
+    count(&hubMetrics, COUNT_REHITS, numShots - numHits);
+    if (numHits == 0) {
+        if (state->info.agents[agent].process != NULL) {
+            state->turnStarted = now_ns();
+            send_yt(&state->info.agents[agent]); // guess again
+        }
+        return NORMAL;
+    }
+    if (state->info.rules.salvo == 1) {
+        send_hit_message(hits[0], state, agent + 1, state->shots[0]);
+    } else {
+        send_salvo_message(state, agent + 1, state->shots, hits, numHits);
+    }
+    note_changes(state, agent ^ 1, state->shots, numHits);
+    record_salvo(worker->recorder, state, round, agent + 1, state->shots, 
+            hits, numHits);
+    if (all_ships_sunk(state->info.agents[agent ^ 1].map)) {
+        end_round(worker, round, agent + 1);
+        return NORMAL;
+    }
+    state->turn = agent ^ 1;
+    start_turn(state, round);
+    return NORMAL;
+}
+
+/**
+ * Play the turns of in-process agents in a round until it is the turn of an
+ * agent process or the round is over.
+ *
+ * worker (Worker*): the worker playing the round
+ * round (int): the round to play
+ *
+ * Returns NORMAL if successful, otherwise a COMM_ERR.
+ *
+ */
+HubStatus play_plugin_turns(Worker* worker, int round) {
+    GameState* state = &worker->rounds->states[round];
+    while (worker->rounds->inProgress[round]) {
+        Agent* agent = &state->info.agents[state->turn];
+        if (agent->plugin == NULL) {
+            break;
+        }
+        state->numShots = salvo_size(state);
+        long start = now_ns();
+        for (int shot = 0; shot < state->numShots; shot++) {
+            state->shots[shot] = agent->plugin->next_guess(agent->handle);
+        }
+        observe(&hubMetrics.programs[agent->program].turns, now_ns() - start);
+        HubStatus status = play_salvo(worker, round);
+        if (status != NORMAL) {
+            return status;
+        }
+    }
+    return NORMAL;
+}
+
+/**
+ * Handle a salvo sent by the agent process whose turn it is.
+ *
+ * worker (Worker*): the worker playing the round
+ * round (int): the round the salvo belongs to
+ *
+ * Returns NORMAL if successful, otherwise a COMM_ERR.
  *
  */
-HubStatus play_game(Rounds* rounds) {
+HubStatus handle_guess(Worker* worker, int round) {
+    GameState* state = &worker->rounds->states[round];
+    int program = state->info.agents[state->turn].program;
+    observe(&hubMetrics.programs[program].turns,
+            now_ns() - state->turnStarted);
     HubStatus status;
-    while (true) {
-        for (int round = 0; round < rounds->rounds; round++) {
-            print_hub_maps(rounds->states[round].maps[0], 
-                    rounds->states[round].maps[1], round);
-            if (!rounds->inProgress[round]) {
-                continue; // this round is no longer playing
+    if ((status = play_salvo(worker, round)) != NORMAL) {
+        return status;
+    }
+    return play_plugin_turns(worker, round);
+}
+
+/**
+ * Find the round a message from an agent process belongs to.
+ *
+ * rounds (Rounds*): the rounds for this game
+ * process (AgentProcess*): the process that sent the message
+ * game (int): the game id of the message, or NO_GAME
+ *
+ * Returns the round, or -1 if the process does not owe a GUESS in the round.
+ *
+ */
+int find_round(Rounds* rounds, AgentProcess* process, int game) {
+    if (process->shared != (game != NO_GAME)) {
+        return -1;
+    }
+    int round = process->shared ? game : process->round;
+    if (round < 0 || round >= rounds->rounds || !rounds->inProgress[round]) {
+        return -1;
+    }
+    GameState* state = &rounds->states[round];
+    if (state->info.agents[state->turn].process != process) {
+        return -1; // not this agent's turn
+    }
+    return round;
+}
+
+/**
+ * Take the next complete salvo an agent process has sent, storing its shots
+ * in the state of its round. In the binary protocol each shot is its own
+ * GUESS record, so a salvo is complete once all of its records have arrived.
+ *
+ * rounds (Rounds*): the rounds for this game
+ * process (AgentProcess*): the process that sent the message
+ * round (int*): the round of the salvo (to be modified)
+ *
+ * Returns NORMAL if a salvo was taken, NO_MESSAGE if there is no complete
+ * salvo yet, otherwise a COMM_ERR.
+ *
+ */
+int next_salvo(Rounds* rounds, AgentProcess* process, int* round) {
+    if (process->binary) {
+        WireRecord record;
+        while (next_buffered_record(&process->buffer, &record)) {
+            *round = find_round(rounds, process, record.game);
+            if (record.type != WIRE_GUESS || *round < 0) {
+                return COMM_ERR;
+            }
+            GameState* state = &rounds->states[*round];
+            state->shots[state->numShots++] = record.pos;
+            if (state->numShots == salvo_size(state)) {
+                return NORMAL;
+            }
+        }
+        return NO_MESSAGE;
+    }
+
+    char* line = next_buffered_line(&process->buffer);
+    if (line == NULL) {
+        return NO_MESSAGE;
+    }
+    Tokenizer tokens = new_tokenizer(line);
+    if (!take_word(&tokens, "GUESS") || 
+            (*round = find_round(rounds, process, take_game(&tokens))) < 0) {
+        return COMM_ERR;
+    }
+    GameState* state = &rounds->states[*round];
+    state->numShots = salvo_size(state);
+    return read_guess_message(&tokens, state->shots, state->numShots);
+}
+
+/**
+ * Read whatever an agent process has sent and handle every complete message.
+ * Never blocks.
+ *
+ * worker (Worker*): the worker playing the rounds of the process
+ * process (AgentProcess*): the process that is readable
+ *
+ * Returns NORMAL if successful, otherwise a COMM_ERR.
+ *
+ */
+HubStatus service_process(Worker* worker, AgentProcess* process) {
+    int numRead = fill_line_buffer(&process->buffer, process->out);
+    if (numRead == 0 || (numRead < 0 && errno != EAGAIN)) {
+        return COMM_ERR; // the agent went away mid-game
+    }
+    if (numRead > 0) {
+        count(&hubMetrics, COUNT_BYTES_RECEIVED, numRead);
+    }
+
+    while (process->activeGames > 0) {
+        int round;
+        int status = next_salvo(worker->rounds, process, &round);
+        if (status == NO_MESSAGE) {
+            break;
+        }
+        if (status != NORMAL || 
+                (status = handle_guess(worker, round)) != NORMAL) {
+            return status;
+        }
+    }
+    return NORMAL;
+}
+
+/**
+ * Play the rounds of a worker. Every round runs independently: the worker
+ * waits for whichever of its agent processes become readable and advances
+ * the rounds their GUESS messages belong to, so a slow agent only holds up
+ * its own rounds.
+ *
+ * worker (Worker*): the worker and the rounds it plays
+ *
+ * Returns NORMAL if successful.
+ *
+ */
+HubStatus play_game(Worker* worker) {
+    Rounds* rounds = worker->rounds;
+    HubStatus status = NORMAL;
+    struct pollfd* fds = malloc(sizeof(struct pollfd) * rounds->numProcesses);
+    AgentProcess** fdProcesses = malloc(sizeof(AgentProcess*) * 
+            rounds->numProcesses);
+
+    for (int i = 0; i < rounds->numProcesses; i++) {
+        if (rounds->processes[i]->worker == worker->first) {
+            int fd = rounds->processes[i]->out;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+    }
+    for (int round = worker->first; round < rounds->rounds && 
+            status == NORMAL; round += worker->step) {
+        count(&hubMetrics, COUNT_GAMES_STARTED, 1);
+        start_turn(&rounds->states[round], round);
+        status = play_plugin_turns(worker, round);
+    }
+
+    while (status == NORMAL) {
+        int numFds = 0;
+        for (int i = 0; i < rounds->numProcesses; i++) {
+            AgentProcess* process = rounds->processes[i];
+            if (process->worker != worker->first || 
+                    process->activeGames == 0) {
+                continue; // not ours, or no longer playing
+            }
+            fds[numFds].fd = process->out;
+            fds[numFds].events = POLLIN;
+            fdProcesses[numFds++] = process;
+        }
+        if (numFds == 0) {
+            break; // every round is over
+        }
+
+        if (poll(fds, numFds, -1) < 0) {
+            if (errno != EINTR) {
+                status = COMM_ERR;
+            }
+            continue;
+        }
+        for (int i = 0; i < numFds && status == NORMAL; i++) {
+            if (fds[i].revents) {
+                status = service_process(worker, fdProcesses[i]);
+            }
+        }
+    }
+
+    free(fds);
+    free(fdProcesses);
+    return status;
+}
+
+/**
+ * Thread entry point for a worker. If the worker fails, the agents of every
+ * round are killed so that the other workers stop as well.
+ *
+ * arg (void*): the worker to run
+ *
+ * Returns NULL.
+ *
+ */
+void* run_worker(void* arg) {
+    Worker* worker = arg;
+    if ((worker->status = play_game(worker)) != NORMAL) {
+        kill_children(worker->rounds);
+    }
+    return NULL;
+}
+
+/**
+ * Play all rounds, sharing them between the given number of workers. With
+ * more than one round the transcript of each round is buffered and
+ * committed to stdout in round order, so that the rounds a worker plays
+ * side by side are never printed interleaved.
+ *
+ * rounds (Rounds*): the rounds for this game
+ * jobs (int): the number of workers
+ * recorder (Recorder*): the binary transcript, NULL if none is recorded
+ *
+ * Returns NORMAL if successful, otherwise the first error of a worker.
+ *
+ */
+HubStatus play_rounds(Rounds* rounds, int jobs, Recorder* recorder) {
+    if (rounds->rounds <= 1) {
+        Worker worker = {.rounds = rounds, .first = 0, .step = 1, 
+                .transcript = NULL, .recorder = recorder};
+        return play_game(&worker);
+    }
+
+    Transcript transcript;
+    pthread_mutex_init(&transcript.lock, NULL);
+    transcript.buffers = calloc(rounds->rounds, sizeof(char*));
+    transcript.sizes = calloc(rounds->rounds, sizeof(size_t));
+    transcript.finished = calloc(rounds->rounds, sizeof(bool));
+    transcript.nextRound = 0;
+    for (int round = 0; round < rounds->rounds; round++) {
+        rounds->states[round].out = open_memstream(
+                &transcript.buffers[round], &transcript.sizes[round]);
+    }
+
+    Worker* workers = malloc(sizeof(Worker) * jobs);
+    for (int job = 0; job < jobs; job++) {
+        workers[job].rounds = rounds;
+        workers[job].first = job;
+        workers[job].step = jobs;
+        workers[job].transcript = &transcript;
+        workers[job].recorder = recorder;
+        pthread_create(&workers[job].thread, NULL, run_worker, &workers[job]);
+    }
+
+    HubStatus status = NORMAL;
+    for (int job = 0; job < jobs; job++) {
+        pthread_join(workers[job].thread, NULL);
+        if (status == NORMAL) {
+            status = workers[job].status;
+        }
+    }
+
+    for (int round = 0; round < rounds->rounds; round++) {
+        if (rounds->states[round].out != NULL) {
+            fclose(rounds->states[round].out); // round did not finish
+            rounds->states[round].out = stdout;
+        }
+        free(transcript.buffers[round]);
+    }
+    free(workers);
+    free(transcript.buffers);
+    free(transcript.sizes);
+    free(transcript.finished);
+    pthread_mutex_destroy(&transcript.lock);
+    return status;
+}
+
+/**
+ * Read the options given before the rules and config arguments.
+ *
+ * argc (int): the number of arguments
+ * argv (char**): the arguments
+ * options (HubOptions*): the options to be modified
+ *
+ * Returns NORMAL if successful, otherwise INCORRECT_ARG_COUNT.
+ *
+ */
+HubStatus read_hub_options(int argc, char** argv, HubOptions* options) {
+    struct option longOptions[] = {
+        {"jobs", required_argument, NULL, 'j'},
+        {"share-agents", no_argument, NULL, 's'},
+        {"binary", no_argument, NULL, 'b'},
+        {"output", required_argument, NULL, 'o'},
+        {"record", required_argument, NULL, 'r'},
+        {"metrics", required_argument, NULL, 'm'},
+        {NULL, 0, NULL, 0}
+    };
+    options->jobs = 1;
+    options->shareAgents = false;
+    options->binary = false;
+    options->output = OUTPUT_FULL;
+    options->recordPath = NULL;
+    options->metricsPath = NULL;
+
+    int option;
+    opterr = 0; // usage errors are reported by hub_exit
+    while ((option = getopt_long(argc, argv, "+j:", longOptions, NULL)) 
+            != -1) {
+        if (option == 'j') {
+            char* err;
+            options->jobs = strtol(optarg, &err, 10);
+            if (err == optarg || *err != '\0' || options->jobs < 0) {
+                return INCORRECT_ARG_COUNT;
+            }
+            if (options->jobs == 0) { // one worker per core
+                options->jobs = sysconf(_SC_NPROCESSORS_ONLN);
             }
-            for (int agent = 0; agent < NUM_AGENTS; agent++) {
-                HitType hitType = HIT_REHIT;
-                while (hitType == HIT_REHIT) {
-                    send_yt(&rounds->states[round].info.agents[agent]);
-                    if ((status = read_guess_message(&rounds->states[round], 
-                            agent + 1, &hitType)) != NORMAL) {
-                        return status;
-                    }
-                }
-
-                if (all_ships_sunk(rounds->states[round].info
-                        .agents[agent ^ 1].map)) {
-                    fprintf(rounds->states[round].info.agents[0].in, 
-                            "DONE %d", agent + 1);
-                    fprintf(rounds->states[round].info.agents[1].in, 
-                            "DONE %d", agent + 1);
-                    printf("GAME OVER - player %d wins\n", agent + 1);
-                    rounds->inProgress[round] = false; // game is over
-                    kill_children(&rounds->states[round]);
-                    if (!rounds_in_progress(rounds)) {
-                        return NORMAL;
-                    }
-                }
+        } else if (option == 's') {
+            options->shareAgents = true;
+        } else if (option == 'b') {
+            options->binary = true;
+        } else if (option == 'o') {
+            if (!read_output_mode(optarg, &options->output)) {
+                return INCORRECT_ARG_COUNT;
             }
+        } else if (option == 'r') {
+            options->recordPath = optarg;
+        } else if (option == 'm') {
+            options->metricsPath = optarg;
+        } else {
+            return INCORRECT_ARG_COUNT;
         }
     }
+    if (argc - optind != 2) {
+        return INCORRECT_ARG_COUNT;
+    }
+    return NORMAL;
 }
 
 int main(int argc, char** argv) {
-    if (argc != 3) {
+    HubOptions options;
+    if (read_hub_options(argc, argv, &options) != NORMAL) {
         hub_exit(INCORRECT_ARG_COUNT, NULL);
     }
+    char* rulesPath = argv[optind];
+    char* configPath = argv[optind + 1];
     GameInfo* info;
     HubStatus status;
     int numRounds = 0;
 
     struct sigaction sa;
-    sa.sa_handler = handle_sighup;
-    sigaction(SIGHUP, &sa, 0);
+    memset(&sa, 0, sizeof(sa));
+    // a dead agent is reported as a communications error instead
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, 0);
+    // SIGHUP and SIGUSR1 are left to the signal thread
+    hubMetrics.path = options.metricsPath;
+    static sigset_t hubSignals;
+    sigemptyset(&hubSignals);
+    sigaddset(&hubSignals, SIGHUP);
+    sigaddset(&hubSignals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &hubSignals, NULL);
+    pthread_t signalThread;
+    pthread_create(&signalThread, NULL, handle_signals, &hubSignals);
+    pthread_detach(signalThread);
     
-    info = read_config_file(argv[2], &status, &numRounds);
+    info = read_config_file(configPath, &status, &numRounds);
     if (status != NORMAL) {
         hub_exit(status, NULL);
     }
 
     Rules rules;
-    if ((status = read_rules_file(argv[1], &rules)) != NORMAL) {
+    if ((status = read_rules_file(rulesPath, &rules)) != NORMAL) {
         hub_exit(status, NULL);
     }
 
+    if (options.jobs > numRounds) {
+        options.jobs = numRounds;
+    }
+    Launcher launcher = {options, NULL, 0, NULL, 0};
     for (int round = 0; round < numRounds; round++) {
-        info[round].rules = rules;
-
-        if ((status = create_children(&info[round], round)) != NORMAL) {
-            hub_exit(status, NULL);
-        }
-
-        for (int agent = 0; agent < NUM_AGENTS; agent++) {
-            send_rules_message(info[round].rules, &info[round].agents[agent]);
-            status = read_map_message(&info[round].agents[agent].map, 
-                    info[round].agents[agent].out);
-            if (status != NORMAL) {
-                hub_exit(status, NULL);
-            }
+        info[round].rules = copy_rules(rules);
+        if ((status = setup_round(&info[round], round, &launcher)) 
+                != NORMAL) {
+            abandon_setup(status, &launcher);
         }
+    }
+    if (options.binary && (status = negotiate_binary(&launcher)) != NORMAL) {
+        abandon_setup(status, &launcher);
+    }
 
-        if ((status = validate_info(info[round])) != NORMAL) {
-            hub_exit(status, NULL);
-        }
+    Recorder recorder;
+    if (options.recordPath != NULL && !start_recording(&recorder, 
+            options.recordPath, rules, numRounds)) {
+        abandon_setup(INCORRECT_ARG_COUNT, &launcher);
     }
+    free_rules(&rules);
 
     Rounds rounds = init_rounds(info, numRounds);
+    for (int round = 0; round < numRounds; round++) {
+        rounds.states[round].output = options.output;
+    }
+    rounds.processes = launcher.processes;
+    rounds.numProcesses = launcher.numProcesses;
     globalRounds = &rounds;
 
-    status = play_game(&rounds);
+    status = play_rounds(&rounds, options.jobs, 
+            options.recordPath != NULL ? &recorder : NULL);
+    if (options.recordPath != NULL) {
+        stop_recording(&recorder, numRounds);
+    }
 
     hub_exit(status, &rounds);
 }
@@ -0,0 +1,872 @@
+#include "game.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+/* Where agents started by the load test write their latency samples */
+#define LOAD_DIR_ENV "LOAD_DIR"
+
+/* Where the relays find the real agents they stand in front of */
+#define LOAD_AGENTS_ENV "LOAD_AGENTS"
+
+/* The name the load test is run under to be a trivial agent */
+#define TRIVIAL_NAME "trivial"
+
+/* The prefix of the name the load test is run under to relay to a real
+ * agent, e.g. "relay-2310A" relays to 2310A */
+#define RELAY_PREFIX "relay-"
+
+/* The prefix of the files holding latency samples */
+#define SAMPLES_PREFIX "lat."
+
+/* How often the hub's memory and descriptors are sampled */
+#define SAMPLE_INTERVAL_NS 1000000L
+
+/* The size of the chunks passed through a relay */
+#define RELAY_CHUNK 4096
+
+/* The round counts played if none are given */
+#define DEFAULT_ROUNDS "1,10,100,1000"
+
+/* The lengths of the ships of a generated fleet, repeated as needed */
+static const int fleetLengths[] = {5, 4, 3, 3, 2};
+#define NUM_FLEET_LENGTHS 5
+
+/* Exit codes for the load test */
+typedef enum {
+    LOAD_NORMAL,
+    LOAD_USAGE,
+    LOAD_SYSTEM_ERR,
+    LOAD_HUB_ERR
+} LoadStatus;
+
+/**
+ * Options given to the load test on the command line.
+ * - rounds: the numbers of rounds to play, one run each
+ * - numRuns: the number of round counts
+ * - cols: the width of the generated board
+ * - rows: the height of the generated board
+ * - numShips: the number of ships in each generated fleet
+ * - jobs: the number of worker threads of the hub, 0 for its default
+ */
+typedef struct LoadOptions {
+    int* rounds;
+    int numRuns;
+    int cols;
+    int rows;
+    int numShips;
+    int jobs;
+} LoadOptions;
+
+/**
+ * The turn latencies gathered from every agent of a run.
+ * - samples: the time from each GUESS to the hub's reply, in nanoseconds
+ * - numSamples: the number of samples
+ * - capacity: the number of samples allocated
+ */
+typedef struct Latencies {
+    long* samples;
+    int numSamples;
+    int capacity;
+} Latencies;
+
+/**
+ * The latencies an agent has measured, kept in a file mapped into memory so
+ * that they survive the hub killing the agent once its game is over.
+ * - fd: the file, -1 if the agent was not started by the load test
+ * - data: the mapped file: the number of samples, then the samples
+ * - capacity: the number of samples the file has room for
+ */
+typedef struct SampleFile {
+    int fd;
+    long* data;
+    long capacity;
+} SampleFile;
+
+/**
+ * What was measured of one run of the hub.
+ * - seconds: the wall time from starting the hub until it exited
+ * - peakRss: the peak resident set of the hub, in kB
+ * - peakFds: the most descriptors the hub had open at once
+ * - status: the exit status of the hub
+ */
+typedef struct RunResult {
+    double seconds;
+    long peakRss;
+    int peakFds;
+    int status;
+} RunResult;
+
+/**
+ * Gets the current time.
+ *
+ * Returns the time in nanoseconds from an arbitrary point.
+ *
+ */
+long now_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+/**
+ * Exit the load test, printing the message for the given status.
+ *
+ * status (LoadStatus): the status to exit with
+ *
+ */
+void load_exit(LoadStatus status) {
+    switch (status) {
+        case LOAD_USAGE:
+            fprintf(stderr, "Usage: 2310load [--rounds n,...] "
+                    "[--board colsxrows] [--ships n] [--jobs n]\n");
+            break;
+        case LOAD_SYSTEM_ERR:
+            fprintf(stderr, "Error setting up load test\n");
+            break;
+        case LOAD_HUB_ERR:
+            fprintf(stderr, "Hub did not finish normally\n");
+            break;
+        default:
+            break;
+    }
+    exit(status);
+}
+
+/**
+ * Add a sample to some latencies.
+ *
+ * latencies (Latencies*): the latencies to add to
+ * sample (long): the latency in nanoseconds
+ *
+ */
+void add_latency(Latencies* latencies, long sample) {
+    if (latencies->numSamples == latencies->capacity) {
+        latencies->capacity = latencies->capacity ?
+                2 * latencies->capacity : 256;
+        latencies->samples = realloc(latencies->samples,
+                sizeof(long) * latencies->capacity);
+    }
+    latencies->samples[latencies->numSamples++] = sample;
+}
+
+/**
+ * Start the file this agent records its latencies in, if it was started by
+ * the load test.
+ *
+ * samples (SampleFile*): the file to start (to be modified)
+ *
+ */
+void open_sample_file(SampleFile* samples) {
+    samples->fd = -1;
+    samples->data = NULL;
+    samples->capacity = 0;
+    char* dir = getenv(LOAD_DIR_ENV);
+    if (dir == NULL) {
+        return;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/" SAMPLES_PREFIX "%d", dir, getpid());
+    samples->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+}
+
+/**
+ * Record a latency in the sample file, growing it as needed.
+ *
+ * samples (SampleFile*): the file to record in
+ * sample (long): the latency in nanoseconds
+ *
+ */
+void record_latency(SampleFile* samples, long sample) {
+    if (samples->fd < 0) {
+        return;
+    }
+    long count = samples->data ? samples->data[0] : 0;
+    if (count == samples->capacity) {
+        long capacity = samples->capacity ? 2 * samples->capacity : 1024;
+        size_t size = sizeof(long) * (capacity + 1);
+        if (samples->data != NULL) {
+            munmap(samples->data, sizeof(long) * (samples->capacity + 1));
+        }
+        samples->data = ftruncate(samples->fd, size) ? MAP_FAILED :
+                mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                samples->fd, 0);
+        if (samples->data == MAP_FAILED) {
+            close(samples->fd);
+            samples->fd = -1;
+            samples->data = NULL;
+            return;
+        }
+        samples->capacity = capacity;
+    }
+    samples->data[count + 1] = sample;
+    samples->data[0] = count + 1;
+}
+
+/**
+ * Print the MAP message for a map file, e.g. "MAP A1,E:C3,S".
+ *
+ * mapPath (char*): the map file, with one "A1 E" ship to a line
+ *
+ * Returns true if successful, else returns false.
+ *
+ */
+bool send_map_file(char* mapPath) {
+    FILE* file = fopen(mapPath, "r");
+    if (file == NULL) {
+        return false;
+    }
+    printf("MAP");
+    char separator = ' ';
+    char* line;
+    while ((line = read_line(file)) != NULL) {
+        strtrim(line);
+        char* space = strchr(line, ' ');
+        if (space != NULL && !is_comment(line)) {
+            *space = ',';
+            printf("%c%s", separator, line);
+            separator = ':';
+        }
+        free(line);
+    }
+    printf("\n");
+    fflush(stdout);
+    fclose(file);
+    return true;
+}
+
+/**
+ * Play as an agent that answers every YT with the next cell of the board
+ * in reading order, timing how long the hub takes to reply to each guess.
+ *
+ * argc (int): the number of arguments
+ * argv (char**): the arguments the hub starts an agent with
+ *
+ * Returns the exit status of the agent.
+ *
+ */
+int trivial_agent(int argc, char** argv) {
+    if (argc != 4) {
+        return 1;
+    }
+    SampleFile samples;
+    open_sample_file(&samples);
+    int cols = 0, next = 0;
+    long sent = 0;
+    char* line;
+    while ((line = read_line(stdin)) != NULL) {
+        Tokenizer tokens = new_tokenizer(line);
+        if (take_word(&tokens, "RULES")) {
+            if (!take_int(&tokens, &cols) || cols <= 0 ||
+                    !send_map_file(argv[2])) {
+                free(line);
+                return 4;
+            }
+        } else if (take_word(&tokens, "YT")) {
+            char text[MAX_POSITION_LENGTH];
+            Position pos = {next / cols, next % cols};
+            next++;
+            printf("GUESS %s\n", format_position(pos, text));
+            fflush(stdout);
+            sent = now_ns();
+        } else if (take_word(&tokens, "OK")) {
+            record_latency(&samples, now_ns() - sent);
+        } else if (take_word(&tokens, "DONE") ||
+                take_word(&tokens, "EARLY")) {
+            free(line);
+            break;
+        }
+        free(line);
+    }
+    return 0;
+}
+
+/**
+ * Write every byte of a buffer to a descriptor.
+ *
+ * fd (int): the descriptor to write to
+ * data (char*): the bytes to write
+ * size (ssize_t): the number of bytes
+ *
+ * Returns true if successful, else returns false.
+ *
+ */
+bool write_all(int fd, char* data, ssize_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        } else if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+/**
+ * Play as a relay between the hub and a real agent, passing every byte
+ * through and timing how long the hub takes to reply to each GUESS.
+ *
+ * argc (int): the number of arguments
+ * argv (char**): the arguments the hub starts an agent with
+ * program (char*): the name of the real agent
+ *
+ * Returns the exit status of the real agent.
+ *
+ */
+int relay_agent(int argc, char** argv, char* program) {
+    char* agents = getenv(LOAD_AGENTS_ENV);
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", agents ? agents : ".", program);
+    int toAgent[2], fromAgent[2];
+    if (pipe(toAgent) || pipe(fromAgent)) {
+        return 1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        return 1;
+    } else if (pid == 0) {
+        dup2(toAgent[0], STDIN_FILENO);
+        dup2(fromAgent[1], STDOUT_FILENO);
+        close(toAgent[0]);
+        close(toAgent[1]);
+        close(fromAgent[0]);
+        close(fromAgent[1]);
+        argv[0] = path;
+        execv(path, argv);
+        _exit(1);
+    }
+    close(toAgent[0]);
+    close(fromAgent[1]);
+    signal(SIGPIPE, SIG_IGN);
+
+    SampleFile samples;
+    open_sample_file(&samples);
+    struct pollfd fds[2] = {
+        {STDIN_FILENO, POLLIN, 0},
+        {fromAgent[0], POLLIN, 0}
+    };
+    bool lineStart = true; // whether the agent's next byte starts a line
+    long sent = 0; // when the last GUESS was passed on, 0 once answered
+    char chunk[RELAY_CHUNK];
+    while (fds[1].fd >= 0) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[0].revents) {
+            ssize_t size = read(STDIN_FILENO, chunk, sizeof(chunk));
+            if (size > 0 && sent != 0) {
+                record_latency(&samples, now_ns() - sent);
+                sent = 0;
+            }
+            if (size <= 0 || !write_all(toAgent[1], chunk, size)) {
+                close(toAgent[1]);
+                fds[0].fd = -1;
+            }
+        }
+        if (fds[1].revents) {
+            ssize_t size = read(fromAgent[0], chunk, sizeof(chunk));
+            if (size <= 0 || !write_all(STDOUT_FILENO, chunk, size)) {
+                fds[1].fd = -1;
+                continue;
+            }
+            bool guessed = false;
+            for (ssize_t i = 0; i < size; i++) {
+                guessed |= lineStart && chunk[i] == 'G';
+                lineStart = chunk[i] == '\n';
+            }
+            if (guessed) {
+                sent = now_ns();
+            }
+        }
+    }
+    close(fromAgent[0]);
+    if (fds[0].fd >= 0) {
+        close(toAgent[1]);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+/**
+ * Read the numbers of rounds to play, separated by commas.
+ *
+ * text (char*): the round counts, e.g. "1,10,100"
+ * options (LoadOptions*): the options to be modified
+ *
+ * Returns true if successful, else returns false.
+ *
+ */
+bool read_round_counts(char* text, LoadOptions* options) {
+    Tokenizer tokens = new_tokenizer(text);
+    free(options->rounds);
+    options->rounds = NULL;
+    options->numRuns = 0;
+    do {
+        int rounds;
+        if (!take_int(&tokens, &rounds) || rounds <= 0) {
+            return false;
+        }
+        options->rounds = realloc(options->rounds,
+                sizeof(int) * (options->numRuns + 1));
+        options->rounds[options->numRuns++] = rounds;
+    } while (take_char(&tokens, ','));
+    return at_end(&tokens);
+}
+
+/**
+ * Read the options of the load test.
+ *
+ * argc (int): the number of arguments
+ * argv (char**): the arguments
+ * options (LoadOptions*): the options to be modified
+ *
+ * Returns LOAD_NORMAL if successful, otherwise LOAD_USAGE.
+ *
+ */
+LoadStatus read_load_options(int argc, char** argv, LoadOptions* options) {
+    struct option longOptions[] = {
+        {"rounds", required_argument, NULL, 'r'},
+        {"board", required_argument, NULL, 'b'},
+        {"ships", required_argument, NULL, 's'},
+        {"jobs", required_argument, NULL, 'j'},
+        {NULL, 0, NULL, 0}
+    };
+    options->rounds = NULL;
+    options->cols = 10;
+    options->rows = 10;
+    options->numShips = 5;
+    options->jobs = -1;
+    char defaultRounds[] = DEFAULT_ROUNDS;
+    read_round_counts(defaultRounds, options);
+
+    int option;
+    char extra;
+    opterr = 0; // usage errors are reported by load_exit
+    while ((option = getopt_long(argc, argv, "+", longOptions, NULL))
+            != -1) {
+        if (option == 'r') {
+            if (!read_round_counts(optarg, options)) {
+                return LOAD_USAGE;
+            }
+        } else if (option == 'b') {
+            if (sscanf(optarg, "%dx%d%c", &options->cols, &options->rows,
+                    &extra) != 2) {
+                return LOAD_USAGE;
+            }
+        } else if (option == 's') {
+            if (sscanf(optarg, "%d%c", &options->numShips, &extra) != 1) {
+                return LOAD_USAGE;
+            }
+        } else if (option == 'j') {
+            if (sscanf(optarg, "%d%c", &options->jobs, &extra) != 1 ||
+                    options->jobs < 0) {
+                return LOAD_USAGE;
+            }
+        } else {
+            return LOAD_USAGE;
+        }
+    }
+    // every ship gets its own row and must fit across the board; the hub
+    // checks the rest of the rules
+    if (optind != argc || options->numShips < 1 ||
+            options->rows < options->numShips ||
+            options->cols < fleetLengths[0]) {
+        return LOAD_USAGE;
+    }
+    return LOAD_NORMAL;
+}
+
+/**
+ * Write a file in the directory of the load test.
+ *
+ * dir (char*): the directory
+ * name (char*): the name of the file
+ *
+ * Returns the file opened for writing, or NULL if it could not be.
+ *
+ */
+FILE* create_file(char* dir, char* name) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return fopen(path, "w");
+}
+
+/**
+ * Write the rules and the map of each player for the generated board. Ship
+ * i lies east along its own row, with the two fleets offset from each other
+ * so that the players do not find them at the same time.
+ *
+ * dir (char*): the directory to write to
+ * options (LoadOptions*): the size of the board and fleet
+ *
+ * Returns true if successful, else returns false.
+ *
+ */
+bool write_board_files(char* dir, LoadOptions* options) {
+    FILE* rules = create_file(dir, "load.rules");
+    if (rules == NULL) {
+        return false;
+    }
+    fprintf(rules, "%d %d\n%d\n", options->cols, options->rows,
+            options->numShips);
+    for (int i = 0; i < options->numShips; i++) {
+        fprintf(rules, "%d\n", fleetLengths[i % NUM_FLEET_LENGTHS]);
+    }
+    fclose(rules);
+
+    char* names[] = {"1.map", "2.map"};
+    for (int player = 0; player < NUM_AGENTS; player++) {
+        FILE* map = create_file(dir, names[player]);
+        if (map == NULL) {
+            return false;
+        }
+        for (int i = 0; i < options->numShips; i++) {
+            int length = fleetLengths[i % NUM_FLEET_LENGTHS];
+            Position pos = {i * options->rows / options->numShips,
+                    (7 * i + 3 * player) % (options->cols - length + 1)};
+            char text[MAX_POSITION_LENGTH];
+            fprintf(map, "%s E\n", format_position(pos, text));
+        }
+        fclose(map);
+    }
+    return true;
+}
+
+/**
+ * Link the names the agents are started under to the load test itself.
+ *
+ * dir (char*): the directory to link in
+ * names (char**): the names to link
+ * numNames (int): the number of names
+ *
+ * Returns true if successful, else returns false.
+ *
+ */
+bool link_agents(char* dir, char** names, int numNames) {
+    char self[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (length < 0) {
+        return false;
+    }
+    self[length] = '\0';
+    for (int i = 0; i < numNames; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        if (symlink(self, path)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Write a config playing the given agents against each other on the
+ * generated maps for a number of rounds.
+ *
+ * dir (char*): the directory of the load test
+ * programs (char**): the name of the agent of each player
+ * rounds (int): the number of rounds
+ *
+ * Returns true if successful, else returns false.
+ *
+ */
+bool write_config(char* dir, char** programs, int rounds) {
+    FILE* config = create_file(dir, "load.cfg");
+    if (config == NULL) {
+        return false;
+    }
+    for (int round = 0; round < rounds; round++) {
+        fprintf(config, "%s/%s,%s/1.map,%s/%s,%s/2.map\n", dir, programs[0],
+                dir, dir, programs[1], dir);
+    }
+    fclose(config);
+    return true;
+}
+
+/**
+ * Sample the peak resident set and the open descriptors of a process.
+ *
+ * pid (pid_t): the process
+ * result (RunResult*): the peaks so far (to be modified)
+ *
+ */
+void sample_process(pid_t pid, RunResult* result) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE* status = fopen(path, "r");
+    if (status != NULL) {
+        char line[256];
+        long peak;
+        while (fgets(line, sizeof(line), status) != NULL) {
+            if (sscanf(line, "VmHWM: %ld", &peak) == 1 &&
+                    peak > result->peakRss) {
+                result->peakRss = peak;
+            }
+        }
+        fclose(status);
+    }
+    snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+    DIR* fds = opendir(path);
+    if (fds != NULL) {
+        int count = 0;
+        struct dirent* entry;
+        while ((entry = readdir(fds)) != NULL) {
+            count += entry->d_name[0] != '.';
+        }
+        closedir(fds);
+        if (count > result->peakFds) {
+            result->peakFds = count;
+        }
+    }
+}
+
+/**
+ * Run the hub on the generated rules and config, sampling it until it
+ * exits. Its output is discarded.
+ *
+ * dir (char*): the directory of the load test
+ * options (LoadOptions*): the options of the load test
+ * result (RunResult*): what was measured (to be modified)
+ *
+ * Returns true if the hub was run, else returns false.
+ *
+ */
+bool run_hub(char* dir, LoadOptions* options, RunResult* result) {
+    char rules[PATH_MAX], config[PATH_MAX], jobs[12];
+    snprintf(rules, sizeof(rules), "%s/load.rules", dir);
+    snprintf(config, sizeof(config), "%s/load.cfg", dir);
+    snprintf(jobs, sizeof(jobs), "%d", options->jobs);
+    char* args[] = {"./2310hub", "--output", "silent", "--jobs", jobs,
+            rules, config, NULL};
+    if (options->jobs < 0) { // leave the hub's default
+        args[3] = rules;
+        args[4] = config;
+        args[5] = NULL;
+    }
+
+    // SIGCHLD is waited for so the hub's exit ends the sampling at once
+    sigset_t childSignal, oldMask;
+    sigemptyset(&childSignal);
+    sigaddset(&childSignal, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childSignal, &oldMask);
+    memset(result, 0, sizeof(RunResult));
+    long start = now_ns();
+    pid_t pid = fork();
+    if (pid < 0) {
+        sigprocmask(SIG_SETMASK, &oldMask, NULL);
+        return false;
+    } else if (pid == 0) {
+        sigprocmask(SIG_SETMASK, &oldMask, NULL);
+        // the hub's metrics are written to stderr as it exits
+        int output = open("/dev/null", O_WRONLY);
+        dup2(output, STDOUT_FILENO);
+        dup2(output, STDERR_FILENO);
+        execv(args[0], args);
+        _exit(127);
+    }
+
+    struct timespec interval = {0, SAMPLE_INTERVAL_NS};
+    int status;
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        sample_process(pid, result);
+        sigtimedwait(&childSignal, NULL, &interval);
+    }
+    result->seconds = (now_ns() - start) / 1e9;
+    result->status = status;
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+    return true;
+}
+
+/**
+ * Gather the latencies written by the agents of a run, removing their
+ * files.
+ *
+ * dir (char*): the directory of the load test
+ * latencies (Latencies*): the latencies to add to
+ *
+ */
+void gather_latencies(char* dir, Latencies* latencies) {
+    DIR* entries = opendir(dir);
+    if (entries == NULL) {
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(entries)) != NULL) {
+        if (strncmp(entry->d_name, SAMPLES_PREFIX, strlen(SAMPLES_PREFIX))) {
+            continue;
+        }
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        FILE* file = fopen(path, "r");
+        long count = 0, sample;
+        if (file != NULL && fread(&count, sizeof(long), 1, file) != 1) {
+            count = 0;
+        }
+        while (count-- > 0 && fread(&sample, sizeof(long), 1, file) == 1) {
+            add_latency(latencies, sample);
+        }
+        if (file != NULL) {
+            fclose(file);
+        }
+        unlink(path);
+    }
+    closedir(entries);
+}
+
+/**
+ * Compare two latencies, for sorting.
+ *
+ * first (const void*): the first latency
+ * second (const void*): the second latency
+ *
+ * Returns a negative, zero or positive number as the first latency is
+ * shorter than, the same as or longer than the second.
+ *
+ */
+int compare_latencies(const void* first, const void* second) {
+    long a = *(const long*) first, b = *(const long*) second;
+    return (a > b) - (a < b);
+}
+
+/**
+ * Gets a percentile of some sorted latencies.
+ *
+ * latencies (Latencies*): the latencies, sorted
+ * fraction (double): the percentile, as a fraction
+ *
+ * Returns the latency in microseconds, or 0 if there are none.
+ *
+ */
+double percentile(Latencies* latencies, double fraction) {
+    if (latencies->numSamples == 0) {
+        return 0;
+    }
+    return latencies->samples[(int) (fraction *
+            (latencies->numSamples - 1))] / 1e3;
+}
+
+/**
+ * Play a number of rounds between two agents and print what was measured
+ * as one tab-separated line. Every turn is one GUESS, so the moves are the
+ * latency samples.
+ *
+ * dir (char*): the directory of the load test
+ * options (LoadOptions*): the options of the load test
+ * name (char*): the name of the agents, as printed
+ * programs (char**): the name each agent is started under
+ * rounds (int): the number of rounds
+ *
+ * Returns LOAD_NORMAL if successful, otherwise the error to exit with.
+ *
+ */
+LoadStatus run_load(char* dir, LoadOptions* options, char* name,
+        char** programs, int rounds) {
+    RunResult result;
+    if (!write_config(dir, programs, rounds) ||
+            !run_hub(dir, options, &result)) {
+        return LOAD_SYSTEM_ERR;
+    }
+    Latencies latencies = {NULL, 0, 0};
+    gather_latencies(dir, &latencies);
+    if (!WIFEXITED(result.status) || WEXITSTATUS(result.status) != 0) {
+        free(latencies.samples);
+        return LOAD_HUB_ERR;
+    }
+    qsort(latencies.samples, latencies.numSamples, sizeof(long),
+            compare_latencies);
+    printf("%s\t%d\t%.1f\t%.0f\t%.1f\t%.1f\t%.1f\t%ld\t%d\n", name, rounds,
+            rounds / result.seconds, latencies.numSamples / result.seconds,
+            percentile(&latencies, 0.5), percentile(&latencies, 0.99),
+            percentile(&latencies, 0.999), result.peakRss, result.peakFds);
+    fflush(stdout);
+    free(latencies.samples);
+    return LOAD_NORMAL;
+}
+
+/**
+ * Remove the directory of the load test and everything in it.
+ *
+ * dir (char*): the directory
+ *
+ */
+void remove_load_dir(char* dir) {
+    DIR* entries = opendir(dir);
+    if (entries != NULL) {
+        struct dirent* entry;
+        while ((entry = readdir(entries)) != NULL) {
+            if (entry->d_name[0] != '.') {
+                char path[PATH_MAX];
+                snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+                unlink(path);
+            }
+        }
+        closedir(entries);
+    }
+    rmdir(dir);
+}
+
+int main(int argc, char** argv) {
+    char* name = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+    if (!strcmp(name, TRIVIAL_NAME)) {
+        return trivial_agent(argc, argv);
+    } else if (!strncmp(name, RELAY_PREFIX, strlen(RELAY_PREFIX))) {
+        return relay_agent(argc, argv, name + strlen(RELAY_PREFIX));
+    }
+
+    LoadOptions options;
+    if (read_load_options(argc, argv, &options) != LOAD_NORMAL) {
+        load_exit(LOAD_USAGE);
+    }
+    char dir[] = "/tmp/2310load-XXXXXX";
+    char agents[PATH_MAX];
+    char* links[] = {TRIVIAL_NAME, RELAY_PREFIX "2310A", RELAY_PREFIX "2310B"};
+    if (mkdtemp(dir) == NULL || getcwd(agents, sizeof(agents)) == NULL) {
+        load_exit(LOAD_SYSTEM_ERR);
+    }
+    setenv(LOAD_DIR_ENV, dir, 1);
+    setenv(LOAD_AGENTS_ENV, agents, 1);
+    LoadStatus status = LOAD_NORMAL;
+    if (!write_board_files(dir, &options) || !link_agents(dir, links, 3)) {
+        status = LOAD_SYSTEM_ERR;
+    }
+
+    // the trivial agents show the cost of the hub alone, and the real ones
+    // are timed through relays
+    char* trivial[] = {links[0], links[0]};
+    char* real[] = {links[1], links[2]};
+    if (status == LOAD_NORMAL) {
+        printf("# agents\trounds\tgames_per_sec\tmoves_per_sec\tp50_us\t"
+                "p99_us\tp999_us\tpeak_rss_kb\tpeak_fds\n");
+    }
+    for (int run = 0; run < options.numRuns && status == LOAD_NORMAL; run++) {
+        status = run_load(dir, &options, "trivial", trivial,
+                options.rounds[run]);
+        if (status == LOAD_NORMAL) {
+            status = run_load(dir, &options, "A-vs-B", real,
+                    options.rounds[run]);
+        }
+    }
+    remove_load_dir(dir);
+    free(options.rounds);
+    load_exit(status);
+}
@@ -0,0 +1,304 @@
+#define _GNU_SOURCE // for fopencookie()
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* The upper bound of each latency bucket, in seconds */
+static const double bucketBounds[NUM_BUCKETS] = {
+    0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025,
+    0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+/**
+ * A stream to an agent process that counts the bytes written through it.
+ * - fd: the pipe to the process
+ * - metrics: where the bytes are counted
+ */
+typedef struct CountedStream {
+    int fd;
+    Metrics* metrics;
+} CountedStream;
+
+/**
+ * Gets the current time.
+ *
+ * Returns the time in nanoseconds from an arbitrary point.
+ *
+ */
+long now_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+/**
+ * Find the metrics of an agent program, adding them if they are new. Must
+ * only be called before the workers start.
+ *
+ * metrics (Metrics*): the metrics of the hub
+ * path (char*): the program
+ *
+ * Returns the index of the program's metrics.
+ *
+ */
+int metrics_program(Metrics* metrics, char* path) {
+    for (int i = 0; i < metrics->numPrograms; i++) {
+        if (!strcmp(metrics->programs[i].path, path)) {
+            return i;
+        }
+    }
+    metrics->programs = realloc(metrics->programs,
+            sizeof(ProgramMetrics) * (metrics->numPrograms + 1));
+    ProgramMetrics* program = &metrics->programs[metrics->numPrograms];
+    memset(program, 0, sizeof(ProgramMetrics));
+    program->path = strdup(path);
+    return metrics->numPrograms++;
+}
+
+/**
+ * Add a latency to a histogram.
+ *
+ * histogram (Histogram*): the histogram to add to
+ * ns (long): the latency in nanoseconds
+ *
+ */
+void observe(Histogram* histogram, long ns) {
+    int bucket = 0;
+    while (bucket < NUM_BUCKETS && ns > bucketBounds[bucket] * 1e9) {
+        bucket++;
+    }
+    __atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sumNs, ns, __ATOMIC_RELAXED);
+}
+
+/**
+ * Add to one of the counters.
+ *
+ * metrics (Metrics*): the metrics of the hub
+ * counter (Counter): the counter to add to
+ * amount (unsigned long): the amount to add
+ *
+ */
+void count(Metrics* metrics, Counter counter, unsigned long amount) {
+    __atomic_fetch_add(&metrics->counters[counter], amount,
+            __ATOMIC_RELAXED);
+}
+
+/**
+ * Write to the pipe of a counted stream, counting the bytes written.
+ *
+ * cookie (void*): the CountedStream
+ * data (const char*): the bytes to write
+ * size (size_t): the number of bytes
+ *
+ * Returns the number of bytes written, 0 on error.
+ *
+ */
+ssize_t counted_write(void* cookie, const char* data, size_t size) {
+    CountedStream* stream = cookie;
+    ssize_t written = write(stream->fd, data, size);
+    if (written <= 0) {
+        return 0;
+    }
+    count(stream->metrics, COUNT_BYTES_SENT, written);
+    return written;
+}
+
+/**
+ * Close the pipe of a counted stream.
+ *
+ * cookie (void*): the CountedStream
+ *
+ * Returns 0 on success, -1 on error.
+ *
+ */
+int counted_close(void* cookie) {
+    CountedStream* stream = cookie;
+    int result = close(stream->fd);
+    free(stream);
+    return result;
+}
+
+/**
+ * Open a stream for writing to a pipe, counting every byte written to it
+ * as sent.
+ *
+ * fd (int): the pipe
+ * metrics (Metrics*): where the bytes are counted
+ *
+ * Returns the stream, which closes the pipe when it is closed.
+ *
+ */
+FILE* open_counted_stream(int fd, Metrics* metrics) {
+    CountedStream* stream = malloc(sizeof(CountedStream));
+    stream->fd = fd;
+    stream->metrics = metrics;
+    cookie_io_functions_t functions = {NULL, counted_write, NULL,
+            counted_close};
+    return fopencookie(stream, "w", functions);
+}
+
+/**
+ * Write a counter in the Prometheus text format.
+ *
+ * stream (FILE*): where to write
+ * name (char*): the name of the counter
+ * help (char*): what the counter counts
+ * value (unsigned long*): the counter
+ *
+ */
+void write_counter(FILE* stream, char* name, char* help,
+        unsigned long* value) {
+    fprintf(stream, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n", name, help,
+            name, name, __atomic_load_n(value, __ATOMIC_RELAXED));
+}
+
+/**
+ * Write the name and labels of a sample of a histogram, escaping the
+ * program as Prometheus requires.
+ *
+ * stream (FILE*): where to write
+ * name (char*): the name of the histogram
+ * suffix (char*): the suffix of the sample, e.g. "_bucket"
+ * path (char*): the program the histogram is for, or NULL
+ * bound (char*): the upper bound of a bucket, or NULL
+ *
+ */
+void write_sample_name(FILE* stream, char* name, char* suffix, char* path,
+        char* bound) {
+    fprintf(stream, "%s%s", name, suffix);
+    if (path == NULL && bound == NULL) {
+        return;
+    }
+    fputc('{', stream);
+    if (path != NULL) {
+        fprintf(stream, "program=\"");
+        for (char* next = path; *next != '\0'; next++) {
+            if (*next == '\n') {
+                fprintf(stream, "\\n");
+                continue;
+            } else if (*next == '\\' || *next == '"') {
+                fputc('\\', stream);
+            }
+            fputc(*next, stream);
+        }
+        fprintf(stream, bound != NULL ? "\"," : "\"");
+    }
+    if (bound != NULL) {
+        fprintf(stream, "le=\"%s\"", bound);
+    }
+    fputc('}', stream);
+}
+
+/**
+ * Write the samples of a histogram in the Prometheus text format.
+ *
+ * stream (FILE*): where to write
+ * name (char*): the name of the histogram
+ * path (char*): the program the histogram is for, or NULL
+ * histogram (Histogram*): the histogram
+ *
+ */
+void write_histogram(FILE* stream, char* name, char* path,
+        Histogram* histogram) {
+    unsigned long total = 0;
+    for (int bucket = 0; bucket <= NUM_BUCKETS; bucket++) {
+        char bound[32] = "+Inf";
+        if (bucket < NUM_BUCKETS) {
+            snprintf(bound, sizeof(bound), "%g", bucketBounds[bucket]);
+        }
+        total += __atomic_load_n(&histogram->buckets[bucket],
+                __ATOMIC_RELAXED);
+        write_sample_name(stream, name, "_bucket", path, bound);
+        fprintf(stream, " %lu\n", total);
+    }
+    write_sample_name(stream, name, "_sum", path, NULL);
+    fprintf(stream, " %.9f\n", __atomic_load_n(&histogram->sumNs,
+            __ATOMIC_RELAXED) / 1e9);
+    write_sample_name(stream, name, "_count", path, NULL);
+    fprintf(stream, " %lu\n", total);
+}
+
+/**
+ * Write the HELP and TYPE lines of a histogram.
+ *
+ * stream (FILE*): where to write
+ * name (char*): the name of the histogram
+ * help (char*): what the histogram measures
+ *
+ */
+void write_histogram_header(FILE* stream, char* name, char* help) {
+    fprintf(stream, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+}
+
+/**
+ * Write every metric of the hub in the Prometheus text format. Safe to call
+ * while the workers are still recording.
+ *
+ * metrics (Metrics*): the metrics of the hub
+ * stream (FILE*): where to write
+ *
+ */
+void write_metrics(Metrics* metrics, FILE* stream) {
+    unsigned long* counters = metrics->counters;
+    write_counter(stream, "hub_shots_total", "Shots resolved by the hub",
+            &counters[COUNT_SHOTS]);
+    write_counter(stream, "hub_rehits_total",
+            "Shots at cells that had already been guessed",
+            &counters[COUNT_REHITS]);
+    write_counter(stream, "hub_games_started_total", "Rounds started",
+            &counters[COUNT_GAMES_STARTED]);
+    write_counter(stream, "hub_games_finished_total", "Rounds won",
+            &counters[COUNT_GAMES_FINISHED]);
+    write_counter(stream, "hub_sent_bytes_total",
+            "Bytes written to agent processes", &counters[COUNT_BYTES_SENT]);
+    write_counter(stream, "hub_received_bytes_total",
+            "Bytes read from agent processes",
+            &counters[COUNT_BYTES_RECEIVED]);
+
+    write_histogram_header(stream, "hub_turn_seconds",
+            "Time from prompting an agent for a turn to reading its guess");
+    for (int i = 0; i < metrics->numPrograms; i++) {
+        write_histogram(stream, "hub_turn_seconds", metrics->programs[i].path,
+                &metrics->programs[i].turns);
+    }
+    write_histogram_header(stream, "hub_agent_start_seconds",
+            "Time taken to start an agent process");
+    for (int i = 0; i < metrics->numPrograms; i++) {
+        write_histogram(stream, "hub_agent_start_seconds",
+                metrics->programs[i].path, &metrics->programs[i].starts);
+    }
+    write_histogram_header(stream, "hub_map_read_seconds",
+            "Time from sending an agent the rules to reading its map");
+    for (int i = 0; i < metrics->numPrograms; i++) {
+        write_histogram(stream, "hub_map_read_seconds",
+                metrics->programs[i].path, &metrics->programs[i].maps);
+    }
+    write_histogram_header(stream, "hub_validate_seconds",
+            "Time taken to validate the maps of a round");
+    write_histogram(stream, "hub_validate_seconds", NULL,
+            &metrics->validations);
+    fflush(stream);
+}
+
+/**
+ * Write the metrics to their file, replacing what was there, or to stderr
+ * if they have no file.
+ *
+ * metrics (Metrics*): the metrics of the hub
+ *
+ */
+void dump_metrics(Metrics* metrics) {
+    if (metrics->path == NULL) {
+        write_metrics(metrics, stderr);
+        return;
+    }
+    FILE* stream = fopen(metrics->path, "w");
+    if (stream != NULL) {
+        write_metrics(metrics, stream);
+        fclose(stream);
+    }
+}
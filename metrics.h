@@ -0,0 +1,79 @@
+#include <stdbool.h>
+#include <stdio.h>
+
+#ifndef METRICS_H
+#define METRICS_H
+
+/* The number of latency buckets with an upper bound; one more bucket holds
+ * everything slower */
+#define NUM_BUCKETS 19
+
+/*
+ * The hub keeps its metrics in memory while it plays and writes them in the
+ * Prometheus text format when asked (see write_metrics()). Every update is
+ * a relaxed atomic add, so the workers never take a lock to record one.
+ */
+
+/* The counters kept by the hub */
+typedef enum Counter {
+    COUNT_SHOTS,
+    COUNT_REHITS,
+    COUNT_GAMES_STARTED,
+    COUNT_GAMES_FINISHED,
+    COUNT_BYTES_SENT,
+    COUNT_BYTES_RECEIVED,
+    NUM_COUNTERS
+} Counter;
+
+/**
+ * A histogram of latencies.
+ * - buckets: the number of latencies in each bucket, not cumulative
+ * - sumNs: the sum of the latencies, in nanoseconds
+ */
+typedef struct Histogram {
+    unsigned long buckets[NUM_BUCKETS + 1];
+    unsigned long sumNs;
+} Histogram;
+
+/**
+ * The latencies of the agents running one program.
+ * - path: the program, as given in the config
+ * - turns: from prompting an agent with YT to reading its complete GUESS
+ * - starts: how long starting each agent process took
+ * - maps: from sending the rules to an agent to reading its map
+ */
+typedef struct ProgramMetrics {
+    char* path;
+    Histogram turns;
+    Histogram starts;
+    Histogram maps;
+} ProgramMetrics;
+
+/**
+ * Everything measured by the hub.
+ * - programs: the latencies of each agent program
+ * - numPrograms: the number of agent programs
+ * - validations: how long validating the maps of each round took
+ * - counters: the value of each Counter
+ * - path: where the metrics are written, NULL for stderr
+ */
+typedef struct Metrics {
+    ProgramMetrics* programs;
+    int numPrograms;
+    Histogram validations;
+    unsigned long counters[NUM_COUNTERS];
+    char* path;
+} Metrics;
+
+/* Recording */
+long now_ns(void);
+int metrics_program(Metrics* metrics, char* path);
+void observe(Histogram* histogram, long ns);
+void count(Metrics* metrics, Counter counter, unsigned long amount);
+FILE* open_counted_stream(int fd, Metrics* metrics);
+
+/* Writing */
+void write_metrics(Metrics* metrics, FILE* stream);
+void dump_metrics(Metrics* metrics);
+
+#endif
@@ -0,0 +1,120 @@
+#include "plugin.h"
+#include "agent.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * An agent played in-process.
+ * - info: the id, map, seed and (once known) rules of the agent
+ * - state: the state of the game, valid once the rules are known
+ * - started: have the rules been received
+ */
+typedef struct PluginAgent {
+    AgentInfo info;
+    AgentState state;
+    bool started;
+} PluginAgent;
+
+/**
+ * Start an agent with the given id, map file and seed.
+ *
+ * id (int): the player id of the agent
+ * mapPath (const char*): the location of the agent's map file
+ * seed (unsigned int): the seed for the agent's guesses
+ *
+ * Returns the agent, or NULL if the id or map is invalid.
+ *
+ */
+void* plugin_init(int id, const char* mapPath, unsigned int seed) {
+    if (id < 1 || id > NUM_AGENTS) {
+        return NULL;
+    }
+    PluginAgent* agent = malloc(sizeof(PluginAgent));
+    char* path = strdup(mapPath);
+    AgentStatus status = read_map_file(path, &agent->info.map);
+    free(path);
+    if (status != AGENT_NORMAL) {
+        free(agent);
+        return NULL;
+    }
+    agent->info.id = id;
+    agent->info.seed = seed;
+    agent->started = false;
+    return agent;
+}
+
+/**
+ * Give the agent the rules of its game.
+ *
+ * handle (void*): the agent
+ * rules (const Rules*): the rules of the game
+ * map (Map*): overwritten with a copy of the agent's ships
+ *
+ * Returns true if successful, false if the map does not fit the rules.
+ *
+ */
+bool plugin_on_rules(void* handle, const Rules* rules, Map* map) {
+    PluginAgent* agent = handle;
+    if (agent->started || agent->info.map.numShips < rules->numShips) {
+        return false;
+    }
+    agent->info.rules = copy_rules(*rules);
+    agent->state = init_agent(agent->info);
+    agent->started = true;
+    *map = copy_map(agent->state.info.map);
+    return true;
+}
+
+/**
+ * Ask the agent for its next guess, or the next shot of its salvo.
+ *
+ * handle (void*): the agent
+ *
+ * Returns the position guessed.
+ *
+ */
+Position plugin_next_guess(void* handle) {
+    PluginAgent* agent = handle;
+    return take_shot(&agent->state);
+}
+
+/**
+ * Tell the agent the result of a guess.
+ *
+ * handle (void*): the agent
+ * id (int): the id of the player who guessed
+ * pos (Position): the position guessed
+ * hit (HitType): the result of the guess
+ *
+ */
+void plugin_on_result(void* handle, int id, Position pos, HitType hit) {
+    PluginAgent* agent = handle;
+    record_hit(&agent->state, id, pos, hit);
+}
+
+/**
+ * Free the agent.
+ *
+ * handle (void*): the agent
+ *
+ */
+void plugin_free(void* handle) {
+    PluginAgent* agent = handle;
+    if (agent->started) {
+        free_agent_state(&agent->state);
+    } else {
+        free_map(&agent->info.map);
+    }
+    free(agent);
+}
+
+__attribute__((visibility("default")))
+const AgentPlugin agent_plugin = {
+    AGENT_PLUGIN_VERSION,
+    plugin_init,
+    plugin_on_rules,
+    plugin_next_guess,
+    plugin_on_result,
+    plugin_free
+};
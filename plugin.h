@@ -0,0 +1,37 @@
+#include "game.h"
+
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+/* Bumped whenever the AgentPlugin structure, or a structure it passes,
+ * changes */
+#define AGENT_PLUGIN_VERSION 2
+
+/* The symbol a plugin library exports its AgentPlugin as */
+#define AGENT_PLUGIN_SYMBOL "agent_plugin"
+
+/**
+ * An agent strategy built as a shared library, which the hub loads with
+ * dlopen() and plays in-process instead of talking to it over pipes. Each
+ * function replaces one part of the text protocol.
+ *
+ * - version: the AGENT_PLUGIN_VERSION the plugin was built with
+ * - init: start an agent (as if exec'd with "id map seed"), returning NULL
+ *   if the id or map is invalid
+ * - on_rules: RULES, filling map with the agent's ships (as MAP would) and
+ *   returning false if the rules do not fit the map
+ * - next_guess: YT, returning the position to GUESS; called once for each
+ *   shot of a salvo before any results are given
+ * - on_result: HIT, SUNK or MISS by player id at the given position
+ * - free: DONE, freeing the agent
+ */
+typedef struct AgentPlugin {
+    int version;
+    void* (*init)(int id, const char* mapPath, unsigned int seed);
+    bool (*on_rules)(void* agent, const Rules* rules, Map* map);
+    Position (*next_guess)(void* agent);
+    void (*on_result)(void* agent, int id, Position pos, HitType hit);
+    void (*free)(void* agent);
+} AgentPlugin;
+
+#endif
@@ -0,0 +1,265 @@
+#include "game.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "transcript.h"
+
+/* Exit codes for the replay tool */
+typedef enum {
+    REPLAY_NORMAL,
+    REPLAY_USAGE,
+    REPLAY_BAD_TRANSCRIPT,
+    REPLAY_MISMATCH
+} ReplayStatus;
+
+/**
+ * Options given to the replay tool on the command line.
+ * - verify: only check the results of the games, printing nothing but a
+ *   count of what was checked
+ * - output: how much of each round is printed, as for the hub
+ */
+typedef struct ReplayOptions {
+    bool verify;
+    OutputMode output;
+} ReplayOptions;
+
+/**
+ * Exit the replay tool, printing the message for the given status.
+ *
+ * status (ReplayStatus): the status to exit with
+ *
+ */
+void replay_exit(ReplayStatus status) {
+    switch (status) {
+        case REPLAY_USAGE:
+            fprintf(stderr, "Usage: 2310replay [--verify] [--output mode] "
+                    "transcript\n");
+            break;
+        case REPLAY_BAD_TRANSCRIPT:
+            fprintf(stderr, "Error reading transcript\n");
+            break;
+        case REPLAY_MISMATCH:
+            fprintf(stderr, "Replay does not match transcript\n");
+            break;
+        default:
+            break;
+    }
+    exit(status);
+}
+
+/**
+ * Gets the hit type the hub reported for a shot result.
+ *
+ * result (ShotResult): the result of the shot
+ *
+ * Returns HIT_MISS, HIT_HIT or HIT_SUNK.
+ *
+ */
+HitType result_hit_type(ShotResult result) {
+    if (result == SHOT_SUNK) {
+        return HIT_SUNK;
+    } else if (result == SHOT_HIT) {
+        return HIT_HIT;
+    }
+    return HIT_MISS;
+}
+
+/**
+ * Set up the state of a recorded game, validating its fleets as the hub
+ * would.
+ *
+ * reader (TranscriptReader*): the transcript the game is in
+ * game (GameRecord*): the game to set up
+ * state (GameState*): the state of the game (to be modified)
+ *
+ * Returns REPLAY_NORMAL if successful, otherwise REPLAY_BAD_TRANSCRIPT.
+ *
+ */
+ReplayStatus init_replay(TranscriptReader* reader, GameRecord* game,
+        GameState* state) {
+    GameInfo info;
+    memset(&info, 0, sizeof(GameInfo));
+    info.rules = copy_rules(reader->rules);
+    for (int player = 0; player < NUM_AGENTS; player++) {
+        if (!read_fleet(reader, game, player, &info.agents[player].map)) {
+            free_game_info(&info);
+            return REPLAY_BAD_TRANSCRIPT;
+        }
+    }
+    if (validate_info(&info) != NORMAL) {
+        free_game_info(&info);
+        return REPLAY_BAD_TRANSCRIPT;
+    }
+    *state = init_game(info);
+    return REPLAY_NORMAL;
+}
+
+/**
+ * Replay a recorded game through the game state, checking that every shot
+ * has the recorded result and that the recorded winner wins. The transcript
+ * is written as the hub wrote it. The players take turns from player 1, and
+ * a turn is the shots in a row by one player, at most a salvo of them.
+ *
+ * reader (TranscriptReader*): the transcript the game is in
+ * game (GameRecord*): the game to replay
+ * output (OutputMode): how much of the game to print
+ * numShots (long*): the count of shots replayed (to be added to)
+ *
+ * Returns REPLAY_NORMAL if the game matches, otherwise the error to exit
+ * with.
+ *
+ */
+ReplayStatus replay_game(TranscriptReader* reader, GameRecord* game,
+        OutputMode output, long* numShots) {
+    GameState state;
+    ReplayStatus status = init_replay(reader, game, &state);
+    if (status != REPLAY_NORMAL) {
+        return status;
+    }
+    state.output = output;
+
+    int shooter = 0;
+    int winner = 0;
+    int shots = 0;
+    int turnShots = 0;
+    ShotRecord shot;
+    while (status == REPLAY_NORMAL && next_shot(reader, game, &shot)) {
+        if (winner != 0 && shot.shooter != winner) {
+            // Only the rest of the winning salvo may follow the win
+            status = REPLAY_MISMATCH;
+            break;
+        }
+        turnShots = shot.shooter == shooter ? turnShots + 1 : 1;
+        if ((shooter == 0 && shot.shooter != 1) ||
+                turnShots > state.info.rules.salvo) {
+            status = REPLAY_BAD_TRANSCRIPT;
+            break;
+        }
+        // The hub prints the maps before each of player 1's turns
+        if (shot.shooter == 1 && shooter != 1) {
+            print_round_maps(&state, game->round);
+        }
+        shooter = shot.shooter;
+        int target = shooter % NUM_AGENTS;
+        HitType hit = mark_ship_hit(&state.maps[target],
+                &state.info.agents[target].map, shot.pos);
+        if (hit != result_hit_type(shot.result)) {
+            status = REPLAY_MISMATCH;
+            break;
+        }
+        print_result(&state, hit, shooter, shot.pos);
+        note_changes(&state, target, &shot.pos, 1);
+        if (all_ships_sunk(state.info.agents[target].map)) {
+            winner = shooter;
+        }
+        shots++;
+    }
+    if (status == REPLAY_NORMAL && (game->next != game->end ||
+            shots != game->numShots)) {
+        status = REPLAY_BAD_TRANSCRIPT;
+    } else if (status == REPLAY_NORMAL && winner != game->winner) {
+        status = REPLAY_MISMATCH;
+    }
+    if (status == REPLAY_NORMAL) {
+        print_game_over(&state, game->round, winner);
+    }
+    *numShots += shots;
+    free_game(&state);
+    return status;
+}
+
+/**
+ * Compare two games by round, for sorting.
+ *
+ * first (const void*): the first game
+ * second (const void*): the second game
+ *
+ * Returns a negative, zero or positive number as the round of the first
+ * game is before, the same as or after that of the second.
+ *
+ */
+int compare_rounds(const void* first, const void* second) {
+    return ((const GameRecord*) first)->round -
+            ((const GameRecord*) second)->round;
+}
+
+/**
+ * Read the options given before the transcript argument.
+ *
+ * argc (int): the number of arguments
+ * argv (char**): the arguments
+ * options (ReplayOptions*): the options to be modified
+ *
+ * Returns REPLAY_NORMAL if successful, otherwise REPLAY_USAGE.
+ *
+ */
+ReplayStatus read_replay_options(int argc, char** argv,
+        ReplayOptions* options) {
+    struct option longOptions[] = {
+        {"verify", no_argument, NULL, 'v'},
+        {"output", required_argument, NULL, 'o'},
+        {NULL, 0, NULL, 0}
+    };
+    options->verify = false;
+    options->output = OUTPUT_FULL;
+
+    int option;
+    opterr = 0; // usage errors are reported by replay_exit
+    while ((option = getopt_long(argc, argv, "+", longOptions, NULL))
+            != -1) {
+        if (option == 'v') {
+            options->verify = true;
+        } else if (option == 'o') {
+            if (!read_output_mode(optarg, &options->output)) {
+                return REPLAY_USAGE;
+            }
+        } else {
+            return REPLAY_USAGE;
+        }
+    }
+    if (argc - optind != 1) {
+        return REPLAY_USAGE;
+    }
+    return REPLAY_NORMAL;
+}
+
+int main(int argc, char** argv) {
+    ReplayOptions options;
+    if (read_replay_options(argc, argv, &options) != REPLAY_NORMAL) {
+        replay_exit(REPLAY_USAGE);
+    }
+    TranscriptReader reader;
+    if (!open_transcript(argv[optind], &reader)) {
+        replay_exit(REPLAY_BAD_TRANSCRIPT);
+    }
+
+    // Games are recorded as they finish; the hub prints them in round order
+    GameRecord* games = NULL;
+    int numGames = 0;
+    GameRecord game;
+    while (next_game(&reader, &game)) {
+        games = realloc(games, sizeof(GameRecord) * (numGames + 1));
+        games[numGames++] = game;
+    }
+    ReplayStatus status = reader.next == reader.data + reader.size ?
+            REPLAY_NORMAL : REPLAY_BAD_TRANSCRIPT;
+    if (!options.verify) {
+        qsort(games, numGames, sizeof(GameRecord), compare_rounds);
+    }
+
+    long numShots = 0;
+    for (int i = 0; i < numGames && status == REPLAY_NORMAL; i++) {
+        status = replay_game(&reader, &games[i],
+                options.verify ? OUTPUT_SILENT : options.output, &numShots);
+    }
+    if (status == REPLAY_NORMAL && options.verify) {
+        printf("Verified %d games, %ld shots\n", numGames, numShots);
+    }
+
+    free(games);
+    close_transcript(&reader);
+    replay_exit(status);
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+# An agent whose MAP gives a ship a direction other than N, S, E or W must
+# be rejected with a communications error (exit 5) before any game starts.
+# An agent accepted by mistake is never sent DONE, so the hub is timed out.
+# Run from the directory holding 2310hub and 2310A.
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+printf '8 8\n5\n5\n4\n3\n2\n1\n' > "$dir/rules.txt"
+printf 'A1 S\nC1 S\nE1 S\nG1 S\nH8 N\n' > "$dir/map.txt"
+cat > "$dir/agent.sh" <<'EOF'
+#!/bin/sh
+read rules
+echo "MAP A1,S:C1,S:E1,S:G1,S:H8,X"
+while read line; do
+    case "$line" in DONE*) exit 0;; esac
+done
+EOF
+chmod +x "$dir/agent.sh"
+echo "$dir/agent.sh,$dir/map.txt,./2310A,$dir/map.txt" > "$dir/config.txt"
+
+timeout 10 ./2310hub "$dir/rules.txt" "$dir/config.txt" > /dev/null \
+        2> "$dir/err.txt"
+status=$?
+if [ $status -ne 5 ] || ! grep -q "Communications error" "$dir/err.txt"; then
+    echo "bad_direction: expected exit 5, got $status" >&2
+    cat "$dir/err.txt" >&2
+    exit 1
+fi
+echo "bad_direction: ok"
@@ -0,0 +1,63 @@
+#!/bin/sh
+# 2310replay must refuse a malformed transcript with exit 2 (bad transcript)
+# instead of playing it. Each transcript is written byte by byte with the
+# layout described in transcript.h: unless a case says otherwise, 8x8 rules,
+# salvo 1, one ship of length 1 at A1 for each player, and one game.
+# Run from the directory holding 2310replay.
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+failed=0
+
+header='NVTR\001\010\010\001\001\001\001'
+fleets='\000\000S\000\000S'
+game="\000\001\010$fleets\001\004"
+
+# Replays the transcript written to $dir/name.nvtr and checks its exit status.
+#
+# name: the name of the case
+# expected: the exit status expected
+check() {
+    timeout 10 ./2310replay --output delta "$dir/$1.nvtr" > /dev/null \
+            2> "$dir/err.txt"
+    status=$?
+    if [ $status -ne "$2" ]; then
+        echo "bad_transcript: $1: expected exit $2, got $status" >&2
+        cat "$dir/err.txt" >&2
+        failed=1
+    fi
+}
+
+# Player 1 sinks player 2's ship with its first shot
+printf "$header$game" > "$dir/valid.nvtr"
+check valid 0
+# Player 1 takes 15 shots in a row with a salvo of 1
+printf "$header\000\001\026$fleets\017\
+\010\020\030\040\050\060\070\100\110\120\130\140\150\160\170" \
+        > "$dir/long_turn.nvtr"
+check long_turn 2
+# Player 2 shoots first
+printf "$header\000\002\010$fleets\001\005" > "$dir/player_2_first.nvtr"
+check player_2_first 2
+# 10001 rows, one more than a rules file allows
+printf "NVTR\001\221\116\010\001\001\001\001$game" > "$dir/many_rows.nvtr"
+check many_rows 2
+# INT_MAX rows and columns
+printf "NVTR\001\377\377\377\377\007\377\377\377\377\007\001\001\001\001\
+$game" > "$dir/huge_board.nvtr"
+check huge_board 2
+# A ship of length 0
+printf "NVTR\001\010\010\001\001\000\001$game" > "$dir/empty_ship.nvtr"
+check empty_ship 2
+# 65536 ships of length 1, one more than a rules file allows
+{
+    printf 'NVTR\001\010\010\001\200\200\004'
+    head -c 65536 /dev/zero | tr '\000' '\001'
+    printf "\001$game"
+} > "$dir/many_ships.nvtr"
+check many_ships 2
+
+if [ $failed -ne 0 ]; then
+    exit 1
+fi
+echo "bad_transcript: ok"
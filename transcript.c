@@ -0,0 +1,385 @@
+#include "transcript.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* The most bytes an unsigned long takes as a varint */
+#define MAX_VARINT_LENGTH 10
+
+/**
+ * Creates a new empty byte buffer.
+ *
+ * Returns the buffer, which allocates nothing until a byte is added.
+ *
+ */
+ByteBuffer empty_byte_buffer(void) {
+    ByteBuffer buffer = {NULL, 0, 0};
+    return buffer;
+}
+
+/**
+ * Adds a number to the end of a byte buffer as a varint.
+ *
+ * buffer (ByteBuffer*): the buffer to add to
+ * value (unsigned long): the number to add
+ *
+ */
+void put_varint(ByteBuffer* buffer, unsigned long value) {
+    if (buffer->size + MAX_VARINT_LENGTH > buffer->capacity) {
+        buffer->capacity = 2 * buffer->capacity + MAX_VARINT_LENGTH;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    while (value >= 0x80) {
+        buffer->data[buffer->size++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buffer->data[buffer->size++] = value;
+}
+
+/**
+ * Free the memory of a byte buffer, leaving it empty.
+ *
+ * buffer (ByteBuffer*): the buffer to be freed
+ *
+ */
+void free_byte_buffer(ByteBuffer* buffer) {
+    free(buffer->data);
+    *buffer = empty_byte_buffer();
+}
+
+/**
+ * Adds a shot to the shots of a game being recorded.
+ *
+ * buffer (ByteBuffer*): the shots of the game
+ * rules (Rules): the rules of the game
+ * shooter (int): the id of the player who took the shot
+ * pos (Position): the position shot at
+ * hit (HitType): the result of the shot, HIT_MISS, HIT_HIT or HIT_SUNK
+ *
+ */
+void record_shot(ByteBuffer* buffer, Rules rules, int shooter, Position pos,
+        HitType hit) {
+    ShotResult result = hit == HIT_SUNK ? SHOT_SUNK :
+            (hit == HIT_HIT ? SHOT_HIT : SHOT_MISS);
+    unsigned long cell = (unsigned long) pos.row * rules.numCols + pos.col;
+    put_varint(buffer, cell << 3 | result << 1 | (shooter - 1));
+}
+
+/**
+ * Writes the header of a binary transcript.
+ *
+ * stream (FILE*): the transcript being written
+ * rules (Rules): the rules of every game
+ * numRounds (int): the number of rounds to be played
+ *
+ */
+void write_transcript_header(FILE* stream, Rules rules, int numRounds) {
+    ByteBuffer header = empty_byte_buffer();
+    put_varint(&header, TRANSCRIPT_VERSION);
+    put_varint(&header, rules.numRows);
+    put_varint(&header, rules.numCols);
+    put_varint(&header, rules.salvo);
+    put_varint(&header, rules.numShips);
+    for (int i = 0; i < rules.numShips; i++) {
+        put_varint(&header, rules.shipLengths[i]);
+    }
+    put_varint(&header, numRounds);
+
+    fwrite(TRANSCRIPT_MAGIC, sizeof(char), TRANSCRIPT_MAGIC_LENGTH, stream);
+    fwrite(header.data, sizeof(uint8_t), header.size, stream);
+    free_byte_buffer(&header);
+}
+
+/**
+ * Writes the block of a finished game to a binary transcript.
+ *
+ * stream (FILE*): the transcript being written
+ * state (GameState*): the state of the game
+ * round (int): the round the game was played in
+ * winner (int): the id of the winning player
+ * shots (ByteBuffer*): the shots of the game, as added by record_shot()
+ * numShots (int): the number of shots
+ *
+ */
+void write_transcript_game(FILE* stream, GameState* state, int round,
+        int winner, ByteBuffer* shots, int numShots) {
+    ByteBuffer body = empty_byte_buffer();
+    for (int player = 0; player < NUM_AGENTS; player++) {
+        Map map = state->info.agents[player].map;
+        for (int i = 0; i < state->info.rules.numShips; i++) {
+            put_varint(&body, map.ships[i].pos.col);
+            put_varint(&body, map.ships[i].pos.row);
+            put_varint(&body, map.ships[i].dir);
+        }
+    }
+    put_varint(&body, numShots);
+
+    ByteBuffer header = empty_byte_buffer();
+    put_varint(&header, round);
+    put_varint(&header, winner);
+    put_varint(&header, body.size + shots->size);
+
+    fwrite(header.data, sizeof(uint8_t), header.size, stream);
+    fwrite(body.data, sizeof(uint8_t), body.size, stream);
+    fwrite(shots->data, sizeof(uint8_t), shots->size, stream);
+    free_byte_buffer(&header);
+    free_byte_buffer(&body);
+}
+
+/**
+ * Reads a varint, without reading past the given end.
+ *
+ * data (const uint8_t**): the first byte of the varint, moved past it
+ * end (const uint8_t*): the byte after the last that may be read
+ * value (unsigned long*): the number read (to be modified)
+ *
+ * Returns true if a whole varint was read, else returns false.
+ *
+ */
+bool get_varint(const uint8_t** data, const uint8_t* end,
+        unsigned long* value) {
+    *value = 0;
+    for (int shift = 0; *data < end && shift < 64; shift += 7) {
+        uint8_t byte = *(*data)++;
+        *value |= (unsigned long) (byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Reads a varint that must fit in an int.
+ *
+ * data (const uint8_t**): the first byte of the varint, moved past it
+ * end (const uint8_t*): the byte after the last that may be read
+ * value (int*): the number read (to be modified)
+ *
+ * Returns true if a number no larger than INT_MAX was read, else returns
+ * false.
+ *
+ */
+bool get_int(const uint8_t** data, const uint8_t* end, int* value) {
+    unsigned long number;
+    if (!get_varint(data, end, &number) || number > INT_MAX) {
+        return false;
+    }
+    *value = number;
+    return true;
+}
+
+/**
+ * Reads the rules and number of rounds from the header of a transcript.
+ *
+ * reader (TranscriptReader*): the reader, whose next byte is moved past
+ * the header
+ *
+ * Returns true if the header is valid, else returns false.
+ *
+ */
+bool read_transcript_header(TranscriptReader* reader) {
+    const uint8_t* end = reader->data + reader->size;
+    int version;
+    Rules* rules = &reader->rules;
+    if (reader->size < TRANSCRIPT_MAGIC_LENGTH || memcmp(reader->data,
+            TRANSCRIPT_MAGIC, TRANSCRIPT_MAGIC_LENGTH) != 0) {
+        return false;
+    }
+    reader->next = reader->data + TRANSCRIPT_MAGIC_LENGTH;
+    if (!get_int(&reader->next, end, &version) ||
+            version != TRANSCRIPT_VERSION ||
+            !get_int(&reader->next, end, &rules->numRows) ||
+            !get_int(&reader->next, end, &rules->numCols) ||
+            !get_int(&reader->next, end, &rules->salvo) ||
+            !get_int(&reader->next, end, &rules->numShips)) {
+        return false;
+    }
+    // Held to the limits of a rules file, and every ship length takes at
+    // least a byte
+    if (!is_valid_row(rules->numRows) || !is_valid_column(rules->numCols) ||
+            rules->salvo < 1 || rules->numShips < 1 ||
+            rules->numShips > UINT16_MAX ||
+            rules->numShips > end - reader->next) {
+        return false;
+    }
+    rules->shipLengths = malloc(sizeof(int) * rules->numShips);
+    for (int i = 0; i < rules->numShips; i++) {
+        if (!get_int(&reader->next, end, &rules->shipLengths[i]) ||
+                rules->shipLengths[i] < 1) {
+            return false;
+        }
+    }
+    return get_int(&reader->next, end, &reader->numRounds);
+}
+
+/**
+ * Maps a binary transcript into memory and reads its header.
+ *
+ * path (const char*): the location of the transcript
+ * reader (TranscriptReader*): the reader to set up
+ *
+ * Returns true if successful, else returns false, with nothing left to be
+ * closed.
+ *
+ */
+bool open_transcript(const char* path, TranscriptReader* reader) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0 || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    reader->data = data;
+    reader->size = info.st_size;
+    reader->rules.shipLengths = NULL;
+    if (!read_transcript_header(reader)) {
+        close_transcript(reader);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Skips past the fleets of a game, checking that each ship can be read.
+ *
+ * reader (TranscriptReader*): the transcript the game is in
+ * data (const uint8_t**): the first byte of the fleets, moved past them
+ * end (const uint8_t*): the byte after the end of the game
+ *
+ * Returns true if every ship was read, else returns false.
+ *
+ */
+bool skip_fleets(TranscriptReader* reader, const uint8_t** data,
+        const uint8_t* end) {
+    for (int i = 0; i < NUM_AGENTS * reader->rules.numShips; i++) {
+        int col, row, dir;
+        if (!get_int(data, end, &col) || !get_int(data, end, &row) ||
+                !get_int(data, end, &dir)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Reads the next game of a transcript. Its shots can then be read with
+ * next_shot().
+ *
+ * reader (TranscriptReader*): the transcript to read from
+ * game (GameRecord*): the game read (to be modified)
+ *
+ * Returns true if a game was read, or false at the end of the transcript or
+ * if the game is invalid.
+ *
+ */
+bool next_game(TranscriptReader* reader, GameRecord* game) {
+    const uint8_t* end = reader->data + reader->size;
+    int length;
+    if (!get_int(&reader->next, end, &game->round) ||
+            !get_int(&reader->next, end, &game->winner) ||
+            !get_int(&reader->next, end, &length) ||
+            length > end - reader->next) {
+        return false;
+    }
+    game->fleets = reader->next;
+    game->end = reader->next + length;
+    reader->next = game->end;
+
+    game->shots = game->fleets;
+    if (!skip_fleets(reader, &game->shots, game->end) ||
+            !get_int(&game->shots, game->end, &game->numShots)) {
+        return false;
+    }
+    game->next = game->shots;
+    return true;
+}
+
+/**
+ * Reads the next shot of a game.
+ *
+ * reader (TranscriptReader*): the transcript the game is in
+ * game (GameRecord*): the game to read from
+ * shot (ShotRecord*): the shot read (to be modified)
+ *
+ * Returns true if a shot was read, or false after the last shot or if the
+ * shot is invalid.
+ *
+ */
+bool next_shot(TranscriptReader* reader, GameRecord* game,
+        ShotRecord* shot) {
+    unsigned long value;
+    if (!get_varint(&game->next, game->end, &value)) {
+        return false;
+    }
+    unsigned long cell = value >> 3;
+    int result = (value >> 1) & 3;
+    if (cell >= (unsigned long) reader->rules.numRows *
+            reader->rules.numCols || result > SHOT_SUNK) {
+        return false;
+    }
+    shot->shooter = (value & 1) + 1;
+    shot->pos.row = cell / reader->rules.numCols;
+    shot->pos.col = cell % reader->rules.numCols;
+    shot->result = result;
+    return true;
+}
+
+/**
+ * Reads the ships of one player of a game, with the lengths given by the
+ * rules.
+ *
+ * reader (TranscriptReader*): the transcript the game is in
+ * game (GameRecord*): the game to read from
+ * player (int): the index of the player
+ * map (Map*): overwritten with the ships of the player, to be freed
+ *
+ * Returns true if successful, else returns false.
+ *
+ */
+bool read_fleet(TranscriptReader* reader, GameRecord* game, int player,
+        Map* map) {
+    const uint8_t* data = game->fleets;
+    *map = empty_map();
+    for (int i = 0; i < (player + 1) * reader->rules.numShips; i++) {
+        Position pos;
+        int dir;
+        if (!get_int(&data, game->end, &pos.col) ||
+                !get_int(&data, game->end, &pos.row) ||
+                !get_int(&data, game->end, &dir) ||
+                !is_valid_direction(dir)) {
+            free_map(map);
+            return false;
+        }
+        if (i >= player * reader->rules.numShips) {
+            add_ship(map, new_ship(0, pos, dir));
+            update_ship_length(&map->ships[map->numShips - 1],
+                    reader->rules.shipLengths[i % reader->rules.numShips]);
+        }
+    }
+    return true;
+}
+
+/**
+ * Unmaps a transcript and frees its rules.
+ *
+ * reader (TranscriptReader*): the transcript to close
+ *
+ */
+void close_transcript(TranscriptReader* reader) {
+    munmap((void*) reader->data, reader->size);
+    free_rules(&reader->rules);
+}
@@ -0,0 +1,116 @@
+#include "game.h"
+
+#include <stddef.h>
+
+#ifndef TRANSCRIPT_H
+#define TRANSCRIPT_H
+
+/* The first bytes of every binary transcript */
+#define TRANSCRIPT_MAGIC "NVTR"
+#define TRANSCRIPT_MAGIC_LENGTH 4
+
+/* Bumped whenever the layout of a binary transcript changes */
+#define TRANSCRIPT_VERSION 1
+
+/*
+ * A binary transcript, as written by "2310hub --record", holds every game
+ * of a run. All numbers are unsigned varints: 7 bits to a byte, low bits
+ * first, with the top bit set on every byte but the last.
+ *
+ * - header: TRANSCRIPT_MAGIC, TRANSCRIPT_VERSION, the rows, columns, salvo
+ *   and number of ships of the rules, the length of each ship, and the
+ *   number of rounds
+ * - then one block for each game, in the order the games finished: its
+ *   round, its winner, and the number of bytes in the rest of the block;
+ *   then for each player, the column, row and direction (one byte, as in a
+ *   map file) of each ship; then the number of shots and the shots
+ * - each shot is one varint: (cell << 3) | (result << 1) | (shooter - 1),
+ *   where cell is row * columns + column and result is a ShotResult
+ */
+
+/* The result of a shot, as stored in a binary transcript */
+typedef enum ShotResult {
+    SHOT_MISS, SHOT_HIT, SHOT_SUNK
+} ShotResult;
+
+/**
+ * A growable run of bytes.
+ * - data: the bytes, NULL until one is added
+ * - size: the number of bytes used
+ * - capacity: the number of bytes allocated
+ */
+typedef struct ByteBuffer {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+} ByteBuffer;
+
+/**
+ * A shot read from a binary transcript.
+ * - shooter: the id of the player who took the shot
+ * - pos: the position shot at
+ * - result: what the shot hit
+ */
+typedef struct ShotRecord {
+    int shooter;
+    Position pos;
+    ShotResult result;
+} ShotRecord;
+
+/**
+ * A game read from a binary transcript. Its fleets and shots are read in
+ * place from the mapped file.
+ * - round: the round the game was played in
+ * - winner: the id of the winning player
+ * - numShots: the number of shots in the game
+ * - fleets: the first byte of the fleets
+ * - shots: the first byte of the shots
+ * - next: the next shot to be read by next_shot()
+ * - end: the byte after the end of the game
+ */
+typedef struct GameRecord {
+    int round;
+    int winner;
+    int numShots;
+    const uint8_t* fleets;
+    const uint8_t* shots;
+    const uint8_t* next;
+    const uint8_t* end;
+} GameRecord;
+
+/**
+ * A binary transcript mapped into memory for reading.
+ * - data: the mapped file
+ * - size: the size of the file
+ * - next: the next game to be read by next_game()
+ * - rules: the rules of every game
+ * - numRounds: the number of rounds the hub played
+ */
+typedef struct TranscriptReader {
+    const uint8_t* data;
+    size_t size;
+    const uint8_t* next;
+    Rules rules;
+    int numRounds;
+} TranscriptReader;
+
+/* Writing */
+ByteBuffer empty_byte_buffer(void);
+void put_varint(ByteBuffer* buffer, unsigned long value);
+void free_byte_buffer(ByteBuffer* buffer);
+void record_shot(ByteBuffer* buffer, Rules rules, int shooter, Position pos,
+        HitType hit);
+void write_transcript_header(FILE* stream, Rules rules, int numRounds);
+void write_transcript_game(FILE* stream, GameState* state, int round,
+        int winner, ByteBuffer* shots, int numShots);
+
+/* Reading */
+bool open_transcript(const char* path, TranscriptReader* reader);
+bool next_game(TranscriptReader* reader, GameRecord* game);
+bool next_shot(TranscriptReader* reader, GameRecord* game,
+        ShotRecord* shot);
+bool read_fleet(TranscriptReader* reader, GameRecord* game, int player,
+        Map* map);
+void close_transcript(TranscriptReader* reader);
+
+#endif